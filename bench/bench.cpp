@@ -0,0 +1,354 @@
+// lufuwfc-bench: reproducible benchmark of the solver
+//
+// Solves synthetic tilesets (8 to 1024 tiles, sparse to dense adjacency) and the example tilesets
+// for a sweep of grid sizes and seeds, and prints the results as JSON. Every configuration is run
+// with fixed seeds and the median of the repeats is reported, so two runs can be compared directly.
+
+#include <lufuWFC.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <new>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+#ifndef LUFUWFC_EXAMPLES_DIR
+#define LUFUWFC_EXAMPLES_DIR "examples"
+#endif
+
+using namespace lufuWFC;
+
+// Count every allocation of the process. The operators are kept out of line, otherwise GCC pairs
+// the inlined malloc and free with new and delete and warns about a mismatch
+#if defined(__GNUC__)
+#define BENCH_NOINLINE __attribute__((noinline))
+#else
+#define BENCH_NOINLINE
+#endif
+
+static std::atomic<size_t> gAllocations{0};
+
+BENCH_NOINLINE void* operator new(size_t size){
+    gAllocations.fetch_add(1, std::memory_order_relaxed);
+    if(void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+BENCH_NOINLINE void* operator new[](size_t size){ return operator new(size); }
+BENCH_NOINLINE void operator delete(void* p) noexcept { std::free(p); }
+BENCH_NOINLINE void operator delete[](void* p) noexcept { std::free(p); }
+BENCH_NOINLINE void operator delete(void* p, size_t) noexcept { std::free(p); }
+BENCH_NOINLINE void operator delete[](void* p, size_t) noexcept { std::free(p); }
+
+// Start a new peak resident set size. Only Linux can reset it (clear_refs), elsewhere the peak stays the
+// one of the whole process. Returns true if the peak was reset
+static bool resetPeakRss(){
+#if defined(__linux__)
+    std::ofstream clearRefs("/proc/self/clear_refs");
+    clearRefs << "5";
+    clearRefs.flush();
+    return clearRefs.good();
+#else
+    return false;
+#endif
+}
+
+// Peak resident set size in bytes since resetPeakRss, or of the process if it couldn't be reset
+static size_t peakRss(){
+#if defined(__linux__)
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if(line.starts_with("VmHWM:")){
+            return std::strtoull(line.c_str() + 6, nullptr, 10) * 1024;
+        }
+    }
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss;
+#else
+    return usage.ru_maxrss * size_t(1024);
+#endif
+#else
+    return 0;
+#endif
+}
+
+// Tileset with random symmetric adjacency. Every tile allows itself in all directions,
+// so a solution always exists. density is the chance that two other tiles may be neighbors
+static TileSet syntheticTileSet(size_t tileCount, double density, uint64_t seed){
+    std::mt19937_64 gen(seed);
+    std::uniform_real_distribution<double> chance(0.0, 1.0);
+    std::uniform_int_distribution<int> weight(1, 10);
+
+    TileSet tileset;
+    tileset.tiles.resize(tileCount);
+    for (size_t t=0; t < tileCount; t++) {
+        Tile& tile = tileset.tiles[t];
+        tile.index = t;
+        tile.name = std::to_string(t);
+        tile.weight = weight(gen);
+        tileset.name_to_index_map[tile.name] = t;
+    }
+
+    // North/south and east/west are mirrored, a rule in one direction implies the opposite one
+    for (size_t a=0; a < tileCount; a++) {
+        for (size_t b=0; b < tileCount; b++) {
+            for (size_t d=0; d < 2; d++) {
+                if(a == b or chance(gen) < density){
+                    tileset.tiles[a].adjacency[d].push_back(b);
+                    tileset.tiles[b].adjacency[d + 2].push_back(a);
+                }
+            }
+        }
+    }
+    return tileset;
+}
+
+struct Settings{
+    std::vector<size_t> sizes = {32, 64};
+    std::vector<size_t> tileCounts = {8, 64, 256, 1024};
+    std::vector<double> densities = {0.05, 0.3, 0.7};
+    std::vector<Propagator> propagators = {Propagator::SupportCount, Propagator::Bitset};
+    size_t seeds = 3;
+    size_t repeats = 3;
+    double slowSeconds = 1.0;
+    int backtrack = 1000;
+    bool checkAllocations = false; // Fail if a solve allocated after initialize
+    bool dynamic = false; // Always use the runtime sized solver instead of the one specialized for the tileset
+    std::string examples = LUFUWFC_EXAMPLES_DIR;
+};
+
+struct Run{
+    double seconds = 0;
+    bool solved = false;
+    size_t decisions = 0;
+    size_t removedTiles = 0;
+    size_t allocations = 0;
+    SearchStats stats;
+};
+
+static double median(std::vector<double> values){
+    std::sort(values.begin(), values.end());
+    return values.empty() ? 0 : values[values.size() / 2];
+}
+
+template<typename Solver>
+static Run solveOnce(Solver& wfc, std::shared_ptr<const CompiledTileSet> tileset, size_t size, int seed, int backtrack){
+    wfc.initialize(size, size, seed, tileset);
+    size_t removedBefore = wfc.getSearchStats().removedTiles;
+    size_t allocationsBefore = gAllocations.load();
+
+    Run run;
+    run.solved = wfc.solve(-1, backtrack);
+    run.allocations = gAllocations.load() - allocationsBefore;
+
+    const SearchStats& stats = wfc.getSearchStats();
+    run.seconds = stats.seconds;
+    run.decisions = stats.decisions;
+    run.removedTiles = stats.removedTiles - removedBefore;
+    run.stats = stats;
+    return run;
+}
+
+static nlohmann::json benchTileSet(const std::string& name, std::shared_ptr<const CompiledTileSet> tileset, const Settings& settings){
+    nlohmann::json results = nlohmann::json::array();
+    for (Propagator propagator : settings.propagators) {
+        for (size_t size : settings.sizes) {
+            // Every configuration measures its own peak where the platform allows it
+            bool ownPeak = resetPeakRss();
+            std::vector<double> cellsPerSecond, stepsPerSecond, allocationsPerCollapse;
+            std::vector<double> observe, collapse, propagate, queueDepth;
+            size_t solved = 0;
+            size_t solveAllocations = 0; // Allocations of the first solve of every seed, initialize has reserved every buffer
+            auto measure = [&](auto& wfc){
+                wfc.setPropagator(propagator);
+                for (size_t seed=0; seed < settings.seeds; seed++) {
+                    // The first solve of a seed warms up the caches, but must not allocate
+                    Run run = solveOnce(wfc, tileset, size, seed, settings.backtrack);
+                    solveAllocations += run.allocations;
+
+                    // Solves that take seconds are stable on their own, repeating them would only cost time
+                    bool slow = run.seconds > settings.slowSeconds;
+                    std::vector<double> seconds;
+                    if(slow){
+                        seconds.push_back(run.seconds);
+                    }
+                    for (size_t r=0; r < settings.repeats and !slow; r++) {
+                        run = solveOnce(wfc, tileset, size, seed, settings.backtrack);
+                        seconds.push_back(std::max(run.seconds, 1e-9));
+                    }
+                    double time = median(seconds);
+
+                    solved += run.solved;
+                    cellsPerSecond.push_back(size * size / time);
+                    stepsPerSecond.push_back(run.removedTiles / time);
+                    allocationsPerCollapse.push_back(double(run.allocations) / std::max<size_t>(run.decisions, 1));
+                    observe.push_back(run.stats.observeSeconds);
+                    collapse.push_back(run.stats.collapseSeconds);
+                    propagate.push_back(run.stats.propagateSeconds);
+                    queueDepth.push_back(run.stats.maxQueueDepth);
+                }
+            };
+
+            if(settings.dynamic){
+                WFC wfc;
+                measure(wfc);
+            } else {
+                withSolverWords(*tileset, [&](auto words){
+                    BasicWFC<decltype(words)::value> wfc;
+                    measure(wfc);
+                });
+            }
+
+            results.push_back({
+                {"tileset", name},
+                {"tiles", tileset->tileCount},
+                {"propagator", propagator == Propagator::SupportCount ? "support" : "bitset"},
+                {"size", size},
+                {"domainWords", settings.dynamic or tileset->words > maxFixedWords ? 0 : tileset->words},
+                {"seeds", settings.seeds},
+                {"cellsPerSecond", median(cellsPerSecond)},
+                {"propagationStepsPerSecond", median(stepsPerSecond)},
+                {"allocationsPerCollapse", median(allocationsPerCollapse)},
+                {"solveAllocations", solveAllocations},
+                {"successRate", double(solved) / std::max<size_t>(settings.seeds, 1)},
+                {"peakRssBytes", peakRss()},
+                {"peakRssScope", ownPeak ? "configuration" : "process"}
+            });
+            // Time per phase of a single solve, only available in builds with LUFUWFC_INSTRUMENT
+            if constexpr (instrumented){
+                results.back()["phases"] = {
+                    {"observeSeconds", median(observe)},
+                    {"collapseSeconds", median(collapse)},
+                    {"propagateSeconds", median(propagate)},
+                    {"maxQueueDepth", median(queueDepth)}
+                };
+            }
+            std::fprintf(stderr, "%s %zu tiles, %zux%zu done\n", name.c_str(), tileset->tileCount, size, size);
+            if(solveAllocations > 0 and settings.checkAllocations){
+                std::fprintf(stderr, "  %zu allocations in solves after initialize\n", solveAllocations);
+            }
+        }
+    }
+    return results;
+}
+
+static std::vector<size_t> parseList(const char* text){
+    std::vector<size_t> values;
+    for (const char* p=text; *p; ) {
+        values.push_back(std::strtoull(p, const_cast<char**>(&p), 10));
+        if(*p == ',') p++;
+        else break;
+    }
+    return values;
+}
+
+static std::vector<double> parseDoubles(const char* text){
+    std::vector<double> values;
+    for (const char* p=text; *p; ) {
+        values.push_back(std::strtod(p, const_cast<char**>(&p)));
+        if(*p == ',') p++;
+        else break;
+    }
+    return values;
+}
+
+int main(int argc, char** argv){
+    Settings settings;
+    for (int i=1; i < argc; i++) {
+        std::string arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : "";
+        if(arg == "--quick"){
+            settings.sizes = {32, 64};
+            settings.tileCounts = {8, 64, 256};
+            settings.densities = {0.3};
+            settings.seeds = 2;
+            settings.repeats = 1;
+        } else if(arg == "--sizes"){ settings.sizes = parseList(value); i++; }
+        else if(arg == "--tiles"){ settings.tileCounts = parseList(value); i++; }
+        else if(arg == "--densities"){ settings.densities = parseDoubles(value); i++; }
+        else if(arg == "--seeds"){ settings.seeds = std::atoi(value); i++; }
+        else if(arg == "--repeats"){ settings.repeats = std::max(std::atoi(value), 1); i++; }
+        else if(arg == "--backtrack"){ settings.backtrack = std::atoi(value); i++; }
+        else if(arg == "--examples"){ settings.examples = value; i++; }
+        else if(arg == "--support-only"){ settings.propagators = {Propagator::SupportCount}; }
+        else if(arg == "--bitset-only"){ settings.propagators = {Propagator::Bitset}; }
+        else if(arg == "--dynamic"){ settings.dynamic = true; }
+        else if(arg == "--check-allocations"){ settings.checkAllocations = true; }
+        else {
+            std::fprintf(stderr, "Usage: lufuwfc-bench [--quick] [--sizes 32,64] [--tiles 8,64] [--densities 0.1,0.5] [--seeds N]\n"
+                                 "                     [--repeats N] [--backtrack N] [--examples DIR] [--support-only | --bitset-only]\n"
+                                 "                     [--dynamic] [--check-allocations]\n");
+            return 2;
+        }
+    }
+
+    setLogStream(nullptr);
+
+    nlohmann::json report;
+    report["simd"] = simd::kernels().level == simd::Level::AVX512 ? "avx512" : simd::kernels().level == simd::Level::AVX2 ? "avx2" : "scalar";
+    report["results"] = nlohmann::json::array();
+    report["loadFromFile"] = nlohmann::json::array();
+
+    // Example tilesets, loading them is measured too
+    for (const char* name : {"landtiles", "pathtiles"}) {
+        std::filesystem::path path = std::filesystem::path(settings.examples) / (std::string(name) + ".json");
+        if(!std::filesystem::exists(path)){
+            std::fprintf(stderr, "Skipping %s, not found\n", path.string().c_str());
+            continue;
+        }
+
+        std::vector<double> seconds;
+        TileSet tileset;
+        for (size_t r=0; r < std::max<size_t>(settings.repeats, 5); r++) {
+            tileset = TileSet();
+            auto start = std::chrono::steady_clock::now();
+            tileset.loadFromFile(path.string());
+            seconds.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        }
+        report["loadFromFile"].push_back({{"tileset", name}, {"seconds", median(seconds)}});
+
+        for (auto& result : benchTileSet(name, std::make_shared<const CompiledTileSet>(tileset), settings)) {
+            report["results"].push_back(result);
+        }
+    }
+
+    for (size_t tileCount : settings.tileCounts) {
+        for (double density : settings.densities) {
+            auto tileset = std::make_shared<const CompiledTileSet>(syntheticTileSet(tileCount, density, tileCount));
+            char name[64];
+            std::snprintf(name, sizeof(name), "synthetic-%zu-%.2f", tileCount, density);
+            for (auto& result : benchTileSet(name, tileset, settings)) {
+                result["density"] = density;
+                report["results"].push_back(result);
+            }
+        }
+    }
+
+    std::printf("%s\n", report.dump(2).c_str());
+
+    // A solver must not allocate after initialize has reserved its buffers, allocations would serialize batch runs
+    if(settings.checkAllocations){
+        size_t allocations = 0;
+        for (const auto& result : report["results"]) {
+            allocations += result["solveAllocations"].get<size_t>();
+        }
+        if(allocations > 0){
+            std::fprintf(stderr, "Solves allocated %zu times after initialize\n", allocations);
+            return 1;
+        }
+    }
+    return 0;
+}
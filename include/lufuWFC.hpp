@@ -5,34 +5,280 @@
 #include <set>
 #include <array>
 #include <map>
+#include <bit>
+#include <cstdint>
+#include <algorithm>
+#include <memory>
+#include <atomic>
+#include <cmath>
+#include <barrier>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <string_view>
+#include <span>
+#include <type_traits>
+#include <cstring>
+#include <cctype>
+#include <limits>
 
 #include <iostream>
 #include <random>
+#include <chrono>
 #include <string>
 #include <fstream>
 #include <nlohmann/json.hpp>
 
+#if defined(__unix__) || defined(__APPLE__)
+#define LUFUWFC_HAS_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if !defined(LUFUWFC_NO_SIMD) && (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define LUFUWFC_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
 namespace lufuWFC{
 
+    // Stream the solver reports its progress to, nullptr turns the output off.
+    // With LUFUWFC_NO_LOG defined it is always nullptr and the logging compiles away
+    inline std::ostream*& logStream(){
+#ifdef LUFUWFC_NO_LOG
+        static std::ostream* stream = nullptr;
+#else
+        static std::ostream* stream = &std::cout;
+#endif
+        return stream;
+    }
+
+    inline void setLogStream(std::ostream* stream){
+        logStream() = stream;
+    }
+
+    // Forwards to the log stream, if there is one
+    class LogStream{
+    public:
+        explicit LogStream(std::ostream* stream): mStream(stream){}
+
+        template<typename T>
+        LogStream& operator<<(const T& value){
+            if(mStream) *mStream << value;
+            return *this;
+        }
+
+        LogStream& operator<<(std::ostream& (*manipulator)(std::ostream&)){
+            if(mStream) *mStream << manipulator;
+            return *this;
+        }
+
+    private:
+        std::ostream* mStream;
+    };
+
+    inline LogStream logger(){
+#ifdef LUFUWFC_NO_LOG
+        return LogStream(nullptr);
+#else
+        return LogStream(logStream());
+#endif
+    }
+
+    // Which cells are neighbors. The opposite of direction d is always (d + count / 2) % count
+    //   Square: north, east, south, west
+    //   Cube:   north, east, up, south, west, down
+    //   Hex:    east, northeast, northwest, west, southwest, southeast. Rows are pointy topped, odd rows are shifted right
+    enum class Neighborhood{
+        Square,
+        Cube,
+        Hex
+    };
+
+    inline constexpr size_t maxDirections = 6;
+
+    inline size_t neighborCount(Neighborhood neighborhood){
+        return neighborhood == Neighborhood::Square ? 4 : 6;
+    }
+
+    // Names of the directions in tileset files
+    inline std::span<const char* const> directionNames(Neighborhood neighborhood){
+        static constexpr const char* square[] = {"north", "east", "south", "west"};
+        static constexpr const char* cube[] = {"north", "east", "up", "south", "west", "down"};
+        static constexpr const char* hex[] = {"east", "northeast", "northwest", "west", "southwest", "southeast"};
+        switch (neighborhood) {
+            case Neighborhood::Cube: return cube;
+            case Neighborhood::Hex: return hex;
+            default: return square;
+        }
+    }
+
+    // Shape of a grid: size, neighborhood and whether opposite borders are neighbors (a torus)
+    struct Topology{
+        Neighborhood neighborhood = Neighborhood::Square;
+        size_t width = 0, height = 0, depth = 1;
+        bool wrap = false;
+
+        static Topology square(size_t width, size_t height, bool wrap = false){
+            return {Neighborhood::Square, width, height, 1, wrap};
+        }
+
+        static Topology cube(size_t width, size_t height, size_t depth, bool wrap = false){
+            return {Neighborhood::Cube, width, height, depth, wrap};
+        }
+
+        // Wrapping rows only line up with an even height, see valid()
+        static Topology hex(size_t width, size_t height, bool wrap = false){
+            return {Neighborhood::Hex, width, height, 1, wrap};
+        }
+
+        size_t directionCount() const { return neighborCount(neighborhood); }
+        size_t size() const { return width * height * depth; }
+
+        // A wrapped hex grid with an odd height joins the last row to the first, both unshifted, which makes
+        // the neighbors asymmetric. Solvers refuse such a topology
+        bool valid() const { return !(neighborhood == Neighborhood::Hex and wrap and height % 2); }
+
+        bool operator==(const Topology&) const = default;
+
+        // Neighbor of every cell in every direction as table[cell * directionCount() + d], -1 at the border.
+        // Cells are numbered x + width * (y + height * z)
+        void buildNeighbors(std::vector<int32_t>& table) const {
+            struct Offset{ int x, y, z; };
+            static constexpr Offset square[] = {{0,-1,0}, {1,0,0}, {0,1,0}, {-1,0,0}};
+            static constexpr Offset cube[] = {{0,-1,0}, {1,0,0}, {0,0,1}, {0,1,0}, {-1,0,0}, {0,0,-1}};
+            // The diagonal neighbors depend on whether the row is shifted
+            static constexpr Offset hexEven[] = {{1,0,0}, {0,-1,0}, {-1,-1,0}, {-1,0,0}, {-1,1,0}, {0,1,0}};
+            static constexpr Offset hexOdd[] = {{1,0,0}, {1,-1,0}, {0,-1,0}, {-1,0,0}, {0,1,0}, {1,1,0}};
+
+            // Coordinate plus offset, wrapped or -1 outside of [0, size)
+            auto move = [&](size_t at, int offset, size_t size) -> int64_t {
+                int64_t n = static_cast<int64_t>(at) + offset;
+                if(wrap) return (n + static_cast<int64_t>(size)) % static_cast<int64_t>(size);
+                return n >= 0 and n < static_cast<int64_t>(size) ? n : -1;
+            };
+
+            size_t count = directionCount();
+            table.resize(size() * count);
+            for (size_t z=0; z < depth; z++) {
+                for (size_t y=0; y < height; y++) {
+                    const Offset* offsets = neighborhood == Neighborhood::Cube ? cube : neighborhood == Neighborhood::Square ? square : y % 2 ? hexOdd : hexEven;
+                    for (size_t x=0; x < width; x++) {
+                        int32_t* neighbors = &table[(x + width * (y + height * z)) * count];
+                        for (size_t d=0; d < count; d++) {
+                            int64_t nX = move(x, offsets[d].x, width), nY = move(y, offsets[d].y, height), nZ = move(z, offsets[d].z, depth);
+                            neighbors[d] = nX < 0 or nY < 0 or nZ < 0 ? -1 : static_cast<int32_t>(nX + width * (nY + height * nZ));
+                        }
+                    }
+                }
+            }
+        }
+    };
+
+    // Output of splitmix64 for the state x. Also mixes seeds and hashes, inputs that differ in one bit give
+    // unrelated outputs
+    inline uint64_t splitmix64(uint64_t x){
+        x += 0x9e3779b97f4a7c15ull;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+        return x ^ (x >> 31);
+    }
+
+    // xoshiro256** seeded with splitmix64. 32 bytes of state, the same numbers for a seed on every platform.
+    // jump advances by 2^128 numbers, so streams made by jumping never overlap
+    class Random{
+    public:
+        Random(uint64_t seed = 0){
+            for (uint64_t& word : mState) {
+                word = splitmix64(seed);
+                seed += 0x9e3779b97f4a7c15ull;
+            }
+        }
+
+        uint64_t next(){
+            uint64_t result = std::rotl(mState[1] * 5, 7) * 9;
+            uint64_t t = mState[1] << 17;
+            mState[2] ^= mState[0];
+            mState[3] ^= mState[1];
+            mState[1] ^= mState[2];
+            mState[0] ^= mState[3];
+            mState[2] ^= t;
+            mState[3] = std::rotl(mState[3], 45);
+            return result;
+        }
+
+        // Uniform in [0, n) without modulo bias, n > 0. Ranges that fit into 32 bits take one multiplication
+        uint64_t below(uint64_t n){
+            if(n <= UINT32_MAX){
+                uint32_t range = static_cast<uint32_t>(n);
+                while (true) {
+                    uint64_t product = (next() >> 32) * range;
+                    uint32_t low = static_cast<uint32_t>(product);
+                    if(low >= range or low >= (0u - range) % range){
+                        return product >> 32;
+                    }
+                }
+            }
+            uint64_t threshold = (0 - n) % n;
+            while (true) {
+                uint64_t value = next();
+                if(value >= threshold){
+                    return value % n;
+                }
+            }
+        }
+
+        // Uniform in [0, 1)
+        double uniform(){
+            return (next() >> 11) * 0x1.0p-53;
+        }
+
+        void jump(){
+            static constexpr uint64_t polynomial[] = {0x180ec6d33cfd0abaull, 0xd5a61266f0c9392cull, 0xa9582618e03fc9aaull, 0x39abdc4529b1661cull};
+            std::array<uint64_t, 4> state{};
+            for (uint64_t word : polynomial) {
+                for (int bit=0; bit < 64; bit++) {
+                    if(word & (uint64_t(1) << bit)){
+                        for (size_t n=0; n < 4; n++) state[n] ^= mState[n];
+                    }
+                    next();
+                }
+            }
+            mState = state;
+        }
+
+        const std::array<uint64_t, 4>& state() const { return mState; }
+        void setState(const std::array<uint64_t, 4>& state){ mState = state; }
+
+    private:
+        std::array<uint64_t, 4> mState;
+    };
+
     struct Tile{
         int index;
         std::string name;
-        int weight;
+        double weight;
 
-        // Neighbors
-        std::array<std::vector<int>, 4> adjacency;
+        // Neighbors, the first neighborCount entries are used
+        std::array<std::vector<int>, maxDirections> adjacency;
     };
 
     struct TileSet{
         std::map<std::string, int> name_to_index_map;
         std::vector<Tile> tiles;
+        Neighborhood neighborhood = Neighborhood::Square;
 
-        void loadFromFile(std::string name){
-            std::cout << "\n--- Start Loading tileset from file ---\n";
+        // Returns false if the file couldn't be read
+        bool loadFromFile(std::string name){
+            logger() << "\n--- Start Loading tileset from file ---\n";
             // Open and parse the JSON file
             std::ifstream file(name);
             if (!file.is_open()) {
-                std::cerr << "Error: Could not open tileset.json" << std::endl;
+                std::cerr << "Error: Could not open " << name << std::endl;
+                return false;
             }
 
             // Parse file to json data
@@ -41,31 +287,41 @@ namespace lufuWFC{
                 file >> data;
             } catch (nlohmann::json::parse_error& e) {
                 std::cerr << "JSON parse error: " << e.what() << std::endl;
+                return false;
             }
             
             // PASS 1: Build the name-to-index map
-            std::cout << "  Pass 1: Building name-to-index map\n";
+            logger() << "  Pass 1: Building name-to-index map\n";
             for (size_t i=0; i < data.size(); i++){
                 std::string name = data[i]["name"];
 
                 // Create mapping entry
                 name_to_index_map[name] = i;
-                std::cout << "      Mapped \"" << name << "\" -> " << i << "\n";
+                logger() << "      Mapped \"" << name << "\" -> " << i << "\n";
+            }
+
+            // The direction names of the first tile tell the neighborhood
+            neighborhood = Neighborhood::Square;
+            if(!data.empty()){
+                const auto& adjacency_json = data[0]["adjacency"];
+                if(adjacency_json.contains("up") or adjacency_json.contains("down")) neighborhood = Neighborhood::Cube;
+                else if(adjacency_json.contains("northeast") or adjacency_json.contains("southwest")) neighborhood = Neighborhood::Hex;
             }
 
             // PASS 2: Build the final Tile objects using the map
-            std::cout << "  Pass 2: Loading full tile data\n\n";
-            const std::vector<std::string> directions = {"north", "east", "south", "west"};
+            logger() << "  Pass 2: Loading full tile data\n\n";
+            std::span<const char* const> directions = directionNames(neighborhood);
 
             for (const auto& tile_json : data) {
                 Tile current_tile;
                 current_tile.name = tile_json["name"];
-                current_tile.weight = tile_json["weight"];
+                current_tile.weight = tile_json["weight"].get<double>();
 
                 // Process adjacency rules
                 const auto& adjacency_json = tile_json["adjacency"];
                 for (size_t i = 0; i < directions.size(); ++i) {
-                    const std::string& dir = directions[i];
+                    const char* dir = directions[i];
+                    if(!adjacency_json.contains(dir)) continue;
 
                     // Get the array of names for the current direction (e.g., ["sand", "water"])
                     const auto& adjacent_names = adjacency_json[dir];
@@ -80,405 +336,3302 @@ namespace lufuWFC{
                 tiles.push_back(current_tile);
             }
             
-            std::cout << "--- Verification: Printing loaded data ---" << std::endl;
-            print();
+            logger() << "--- Verification: Printing loaded data ---" << std::endl;
+            if(std::ostream* stream = logStream()){
+                print(*stream);
+            }
 
-            std::cout << "--- Tile loading complete ---" << std::endl;
+            logger() << "--- Tile loading complete ---" << std::endl;
+            return true;
         }
 
-        void print() {
-            const std::vector<std::string> directions = {"North", "East", "South", "West"};
+        void print(std::ostream& out = std::cout) {
+            std::span<const char* const> directions = directionNames(neighborhood);
             for (const auto& tile : tiles) {
-                std::cout << "===================================\n";
-                std::cout << "Tile: " << tile.name << " (Index: " << name_to_index_map.at(tile.name)  << ")\n";
-                std::cout << "Weight: " << tile.weight << "\n";
-                std::cout << "Adjacency Rules (by index):\n";
+                out << "===================================\n";
+                out << "Tile: " << tile.name << " (Index: " << name_to_index_map.at(tile.name)  << ")\n";
+                out << "Weight: " << tile.weight << "\n";
+                out << "Adjacency Rules (by index):\n";
                 for (size_t i = 0; i < directions.size(); ++i) {
-                    std::cout << "  - " << directions[i] << ": [ ";
+                    std::string name = directions[i];
+                    name[0] = std::toupper(name[0]);
+                    out << "  - " << name << ": [ ";
                     for (int adj_index : tile.adjacency[i]) {
-                        std::cout << adj_index << " ";
+                        out << adj_index << " ";
                     }
-                    std::cout << "]\n";
+                    out << "]\n";
                 }
             }
-            std::cout << "===================================\n";
+            out << "===================================\n";
         }
     };
 
-    struct Cell{
-        size_t x;
-        size_t y;
-        bool collapsed;
-        std::vector<int> possibleTiles;
+    // Read only view of a whole file. Uses mmap where it is available, so processes that load the
+    // same file share its pages. Elsewhere the file is read into memory
+    class MappedFile{
+    public:
+        MappedFile(){}
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+        MappedFile(MappedFile&& other) noexcept { swap(other); }
+        MappedFile& operator=(MappedFile&& other) noexcept { swap(other); return *this; }
+        ~MappedFile(){ close(); }
+
+        bool open(const std::string& path){
+            close();
+#ifdef LUFUWFC_HAS_MMAP
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if(fd < 0){
+                return false;
+            }
+            struct stat info;
+            if(fstat(fd, &info) != 0 or info.st_size <= 0){
+                ::close(fd);
+                return false;
+            }
+            void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            ::close(fd);
+            if(data == MAP_FAILED){
+                return false;
+            }
+            mData = static_cast<const uint8_t*>(data);
+            mSize = info.st_size;
+            mMapped = true;
+#else
+            std::ifstream file(path, std::ios::binary | std::ios::ate);
+            if(!file.is_open()){
+                return false;
+            }
+            mSize = file.tellg();
+            mBuffer.resize((mSize + 7) / 8);
+            file.seekg(0);
+            if(!file.read(reinterpret_cast<char*>(mBuffer.data()), mSize)){
+                close();
+                return false;
+            }
+            mData = reinterpret_cast<const uint8_t*>(mBuffer.data());
+#endif
+            return true;
+        }
 
-        size_t getEntropy(){ return possibleTiles.size(); }
-    };
+        void close(){
+#ifdef LUFUWFC_HAS_MMAP
+            if(mMapped){
+                munmap(const_cast<uint8_t*>(mData), mSize);
+            }
+#endif
+            mBuffer.clear();
+            mData = nullptr;
+            mSize = 0;
+            mMapped = false;
+        }
 
-    struct Grid{
-        size_t mX, mY;
-        std::vector<Cell> mData;
+        const uint8_t* data() const { return mData; }
+        size_t size() const { return mSize; }
 
-        Grid(){}
-        Grid(size_t& x, size_t& y){
-            reserve(x, y);
+    private:
+        const uint8_t* mData = nullptr;
+        size_t mSize = 0;
+        bool mMapped = false;
+        std::vector<uint64_t> mBuffer; // Without mmap, 64 bit words keep the sections aligned
+
+        void swap(MappedFile& other){
+            std::swap(mData, other.mData);
+            std::swap(mSize, other.mSize);
+            std::swap(mMapped, other.mMapped);
+            std::swap(mBuffer, other.mBuffer);
         }
-        
-        void reserve(const size_t& x, const size_t& y){
-            mData.reserve(x * y);
-            mX = x;
-            mY = y;
+    };
+
+    // Immutable tables the solver needs from a tileset. Compile once and share it between solvers and threads.
+    // All tables are views into one binary blob. compile builds the blob in memory, save writes it to a file
+    // and load maps such a file and uses it in place, without parsing anything
+    struct CompiledTileSet{
+        static constexpr uint32_t formatVersion = 3;
+        // Larger tilesets get no adjacency masks, they would take tileCount^2 / 16 bytes per direction
+        static constexpr size_t maxMaskTiles = 4096;
+
+        size_t directionCount = 4;
+        size_t tileCount = 0;
+        size_t words = 0; // 64 bit words per cell
+        std::span<const double> weights;
+        // w and w log w in fixed point. Integer sums don't depend on the order tiles are removed in,
+        // so every propagation order ends with the same entropies
+        static constexpr double fixedScale = 1 << 24;
+        std::span<const int64_t> fixedWeights;
+        std::span<const int64_t> weightLogWeight;
+        int64_t sumWeight = 0; // Of fixedWeights
+        int64_t sumWeightLogWeight = 0;
+
+        // Alias table of the fixed weights: column c is tile c if the low 32 bits of the random number are
+        // below aliasThreshold[c], otherwise aliasTile[c]
+        std::span<const uint32_t> aliasThreshold;
+        std::span<const uint32_t> aliasTile;
+
+        // Bitmask of allowed neighbors for every direction and tile, words words each. Empty without masks
+        std::span<const uint64_t> adjacencyMasks;
+
+        // Compatibility lists: the tiles allowed in direction d next to tile t are
+        // compatibleTiles[compatibleOffsets[d * tileCount + t] .. compatibleOffsets[d * tileCount + t + 1]]
+        std::span<const uint32_t> compatibleOffsets;
+        std::span<const uint32_t> compatibleTiles;
+
+        // Number of tiles that allow a tile in a direction, [d * tileCount + tile]
+        std::span<const uint32_t> initialSupport;
+
+        CompiledTileSet(){}
+        explicit CompiledTileSet(const TileSet& tileset){
+            compile(tileset);
         }
 
-        void resize(const size_t& x, const size_t& y){
-            mData.resize(x * y);
-            mX = x;
-            mY = y;
+        // The tables point into the blob, a copy would point into the original
+        CompiledTileSet(const CompiledTileSet&) = delete;
+        CompiledTileSet& operator=(const CompiledTileSet&) = delete;
+        CompiledTileSet(CompiledTileSet&&) = default;
+        CompiledTileSet& operator=(CompiledTileSet&&) = default;
+
+        void compile(const TileSet& tileset){
+            size_t count = tileset.tiles.size();
+            size_t directionCount = neighborCount(tileset.neighborhood);
+
+            std::vector<double> tileWeights(count);
+            std::vector<std::string> tileNames(count);
+            for (size_t t=0; t < count; t++) {
+                tileWeights[t] = tileset.tiles[t].weight;
+                tileNames[t] = tileset.tiles[t].name;
+            }
+
+            // Sorted lists, so duplicated rules are only counted once
+            std::vector<uint32_t> offsets(directionCount * count + 1, 0);
+            std::vector<uint32_t> compatible;
+            for (size_t d=0; d < directionCount; d++) {
+                for (size_t t=0; t < count; t++) {
+                    size_t begin = compatible.size();
+                    compatible.insert(compatible.end(), tileset.tiles[t].adjacency[d].begin(), tileset.tiles[t].adjacency[d].end());
+                    std::sort(compatible.begin() + begin, compatible.end());
+                    compatible.erase(std::unique(compatible.begin() + begin, compatible.end()), compatible.end());
+                    offsets[d * count + t + 1] = compatible.size();
+                }
+            }
+
+            compile(directionCount, tileWeights, offsets, compatible, tileNames);
         }
 
-        bool isOutOfBound(const size_t& x, const size_t& y){
-            return x < 0 or x >= mX or y < 0 or y >= mY;
+        // Compile from compatibility lists in the layout of compatibleOffsets and compatibleTiles. Every list has
+        // to be sorted and free of duplicates. Without names the tiles are named by their index.
+        // Tilesets above maxMaskTiles tiles get no adjacency masks and are always solved with support counts
+        void compile(size_t directionCount, std::span<const double> tileWeights, std::span<const uint32_t> offsets,
+                     std::span<const uint32_t> compatible, std::span<const std::string> tileNames = {}){
+            size_t count = tileWeights.size();
+            size_t wordCount = (count + 63) / 64;
+            size_t maskWords = count <= maxMaskTiles ? wordCount : 0;
+
+            std::vector<double> weightValues(count);
+            std::vector<int64_t> tileFixedWeights(count);
+            std::vector<int64_t> tileWeightLogWeight(count);
+            int64_t totalWeight = 0, totalWeightLogWeight = 0;
+            for (size_t t=0; t < count; t++) {
+                double weight = std::max(tileWeights[t], 0.0);
+                weightValues[t] = weight;
+                tileFixedWeights[t] = std::llround(weight * fixedScale);
+                tileWeightLogWeight[t] = weight > 0 ? std::llround(weight * std::log(weight) * fixedScale) : 0;
+                totalWeight += tileFixedWeights[t];
+                totalWeightLogWeight += tileWeightLogWeight[t];
+            }
+
+            // Vose's alias method, every column holds 1 / count of the total weight
+            std::vector<uint32_t> thresholds(count, UINT32_MAX);
+            std::vector<uint32_t> aliases(count);
+            {
+                std::vector<double> probability(count);
+                std::vector<uint32_t> small, large;
+                for (size_t t=0; t < count; t++) {
+                    aliases[t] = t;
+                    probability[t] = totalWeight > 0 ? static_cast<double>(tileFixedWeights[t]) * count / totalWeight : 1.0;
+                    (probability[t] < 1.0 ? small : large).push_back(t);
+                }
+                while (!small.empty() and !large.empty()) {
+                    uint32_t less = small.back(), more = large.back();
+                    small.pop_back();
+                    thresholds[less] = static_cast<uint32_t>(std::min(probability[less] * 4294967296.0, 4294967295.0));
+                    aliases[less] = more;
+                    probability[more] -= 1.0 - probability[less];
+                    if(probability[more] < 1.0){
+                        large.pop_back();
+                        small.push_back(more);
+                    }
+                }
+                // Columns left over are full, up to rounding
+            }
+
+            std::vector<uint64_t> masks(directionCount * count * maskWords, 0);
+            std::vector<uint32_t> support(directionCount * count, 0);
+            for (size_t d=0; d < directionCount; d++) {
+                for (size_t t=0; t < count; t++) {
+                    uint64_t* mask = maskWords ? &masks[(d * count + t) * maskWords] : nullptr;
+                    for (size_t n=offsets[d * count + t]; n < offsets[d * count + t + 1]; n++) {
+                        uint32_t u = compatible[n];
+                        support[d * count + u]++;
+                        if(mask) mask[u / 64] |= uint64_t(1) << (u % 64);
+                    }
+                }
+            }
+
+            // Interned names, sorted for findTile
+            std::vector<uint32_t> nameOffsets(count + 1, 0);
+            std::string names;
+            for (size_t t=0; t < count; t++) {
+                names += t < tileNames.size() ? tileNames[t] : std::to_string(t);
+                nameOffsets[t + 1] = names.size();
+            }
+            std::vector<uint32_t> nameOrder(count);
+            for (size_t t=0; t < count; t++) nameOrder[t] = t;
+            auto nameOf = [&](uint32_t t){ return std::string_view(names).substr(nameOffsets[t], nameOffsets[t + 1] - nameOffsets[t]); };
+            std::sort(nameOrder.begin(), nameOrder.end(), [&](uint32_t a, uint32_t b){
+                return nameOf(a) < nameOf(b);
+            });
+
+            // Write the blob
+            Header header{};
+            std::memcpy(header.magic, magic, sizeof(header.magic));
+            header.version = formatVersion;
+            header.directionCount = directionCount;
+            header.tileCount = count;
+            header.maskWords = maskWords;
+            header.compatibleCount = compatible.size();
+            header.nameBytes = names.size();
+            header.sumWeight = totalWeight;
+            header.sumWeightLogWeight = totalWeightLogWeight;
+
+            Layout sections = layout(directionCount, header.tileCount, header.maskWords, header.compatibleCount, header.nameBytes);
+            header.size = sections.size;
+
+            mFile.close();
+            mStorage.assign(sections.size / 8, 0);
+            uint8_t* blob = reinterpret_cast<uint8_t*>(mStorage.data());
+            auto put = [&](size_t offset, const void* data, size_t bytes){
+                if(bytes > 0) std::memcpy(blob + offset, data, bytes);
+            };
+            put(sections.weights, weightValues.data(), count * sizeof(double));
+            put(sections.fixedWeights, tileFixedWeights.data(), count * sizeof(int64_t));
+            put(sections.aliasThreshold, thresholds.data(), count * sizeof(uint32_t));
+            put(sections.aliasTile, aliases.data(), count * sizeof(uint32_t));
+            put(sections.weightLogWeight, tileWeightLogWeight.data(), count * sizeof(int64_t));
+            put(sections.adjacencyMasks, masks.data(), masks.size() * sizeof(uint64_t));
+            put(sections.compatibleOffsets, offsets.data(), offsets.size() * sizeof(uint32_t));
+            put(sections.compatibleTiles, compatible.data(), compatible.size() * sizeof(uint32_t));
+            put(sections.initialSupport, support.data(), support.size() * sizeof(uint32_t));
+            put(sections.nameOffsets, nameOffsets.data(), nameOffsets.size() * sizeof(uint32_t));
+            put(sections.nameOrder, nameOrder.data(), nameOrder.size() * sizeof(uint32_t));
+            put(sections.names, names.data(), names.size());
+
+            header.checksum = checksum(blob + sizeof(Header), sections.size - sizeof(Header));
+            put(0, &header, sizeof(Header));
+
+            bind(blob, sections.size, false);
         }
 
-        int getX(){ return mX; }
-        int getY(){ return mY; }
+        // Write the blob to a file. Returns false if it couldn't be written
+        bool save(const std::string& path) const {
+            std::ofstream file(path, std::ios::binary);
+            file.write(reinterpret_cast<const char*>(mBlob.data()), mBlob.size());
+            return file.good();
+        }
 
-        int index(size_t x, size_t y) const { return mX * y + x; }
+        // Map a file written by save. verify checks the checksum and every table index, which reads the whole
+        // file once. Only skip it for files you wrote yourself. Returns false if the file is not a valid tileset
+        bool load(const std::string& path, bool verify = true){
+            MappedFile file;
+            if(!file.open(path)){
+                return false;
+            }
+            if(!bind(file.data(), file.size(), verify)){
+                return false;
+            }
+            mStorage.clear();
+            mFile = std::move(file);
+            return true;
+        }
 
-        Cell& operator()(size_t x, size_t y){ return mData[index(x, y)]; }
-        const Cell& operator()(size_t x, size_t y) const { return mData[index(x, y)]; }
-    };
+        // True if the file starts like a compiled tileset
+        static bool isCompiled(const std::string& path){
+            char head[sizeof(magic)] = {};
+            std::ifstream file(path, std::ios::binary);
+            return file.read(head, sizeof(head)) and std::memcmp(head, magic, sizeof(head)) == 0;
+        }
 
-    struct Neighbor{
-        size_t di;
-        size_t x;
-        size_t y;
-        Neighbor(const size_t xPos, const size_t yPos, const size_t directionIndex): di(directionIndex), x(xPos), y(yPos){}
-    };
+        std::span<const uint8_t> blob() const { return mBlob; }
 
-    struct BackTracker{
-        std::vector<Cell> changedCells;
+        // Checksum of the tables, snapshots use it to recognize their tileset
+        uint64_t contentHash() const {
+            Header header;
+            std::memcpy(&header, mBlob.data(), sizeof(Header));
+            return header.checksum;
+        }
 
-        void reset(){
-            changedCells.clear();
+        // Index of the tile with this name, -1 if there is none
+        int findTile(std::string_view name) const {
+            auto it = std::lower_bound(mNameOrder.begin(), mNameOrder.end(), name, [&](uint32_t tile, std::string_view value){
+                return tileName(tile) < value;
+            });
+            return it != mNameOrder.end() and tileName(*it) == name ? static_cast<int>(*it) : -1;
         }
 
-        void saveChange(Cell& changedCell){
-            changedCells.push_back(changedCell);
+        // Draw a tile of the full domain from one random number
+        size_t sample(uint64_t random) const {
+            size_t column = ((random >> 32) * tileCount) >> 32;
+            return static_cast<uint32_t>(random) < aliasThreshold[column] ? column : aliasTile[column];
         }
 
-        void revert(Grid& grid){
-            for (const auto& cell : changedCells) {
-                grid(cell.x, cell.y) = cell;
-            }
+        std::string_view tileName(size_t tile) const {
+            return std::string_view(mNames.data() + mNameOffsets[tile], mNameOffsets[tile + 1] - mNameOffsets[tile]);
         }
-    };
 
-    class WFC{
-    public:
-        Grid grid;
-        BackTracker tracker;
+        // False for tilesets above maxMaskTiles tiles, they can only be solved with support counts
+        bool hasMasks() const { return !adjacencyMasks.empty() or tileCount == 0; }
 
-        WFC(){}
-        ~WFC(){}
+        const uint64_t* adjacencyMask(size_t tile, size_t direction) const {
+            return &adjacencyMasks[(direction * tileCount + tile) * words];
+        }
 
-        // Returns true if wfc generation failed
-        bool failed(){
-            return mError;
+        const uint32_t* compatibleBegin(size_t tile, size_t direction) const {
+            return compatibleTiles.data() + compatibleOffsets[direction * tileCount + tile];
         }
 
-        // Initialize grid width, height, seed and tileset. Seed -1 is a random seed
-        void initialize(int width, int height, int seed, TileSet& tileset){
-            std::cout << "\n--- Initialize WFC ---" << std::endl;
-            // Set stepCount to zero
-            stepCount = 0;
+        const uint32_t* compatibleEnd(size_t tile, size_t direction) const {
+            return compatibleTiles.data() + compatibleOffsets[direction * tileCount + tile + 1];
+        }
 
-            // Set tileset
-            mTileset = tileset;
+    private:
+        static constexpr char magic[8] = {'L', 'W', 'F', 'C', 'T', 'I', 'L', 'E'};
+
+        // Start of the blob. The blob is little endian and every section starts at a multiple of 8 bytes
+        struct Header{
+            char magic[8];
+            uint32_t version;
+            uint32_t directionCount;
+            uint64_t tileCount;
+            uint64_t maskWords; // 64 bit words per mask, 0 without masks
+            uint64_t compatibleCount;
+            uint64_t nameBytes;
+            int64_t sumWeight;
+            int64_t sumWeightLogWeight;
+            uint64_t size;     // Bytes of the whole blob
+            uint64_t checksum; // Of everything after the header
+        };
+
+        // Byte offsets of the sections in file order
+        struct Layout{
+            size_t weights, fixedWeights, weightLogWeight, aliasThreshold, aliasTile, adjacencyMasks, compatibleOffsets, compatibleTiles;
+            size_t initialSupport, nameOffsets, nameOrder, names, size;
+        };
+
+        std::vector<uint64_t> mStorage; // Blob built by compile
+        MappedFile mFile;               // Blob loaded by load
+        std::span<const uint8_t> mBlob;
+        std::span<const uint32_t> mNameOffsets;
+        std::span<const uint32_t> mNameOrder;
+        std::span<const char> mNames;
+
+        static Layout layout(uint64_t directionCount, uint64_t tileCount, uint64_t maskWords, uint64_t compatibleCount, uint64_t nameBytes){
+            size_t at = sizeof(Header);
+            auto section = [&](uint64_t bytes){
+                size_t start = at;
+                at += (bytes + 7) / 8 * 8;
+                return start;
+            };
+
+            Layout sections;
+            sections.weights = section(tileCount * sizeof(double));
+            sections.fixedWeights = section(tileCount * sizeof(int64_t));
+            sections.weightLogWeight = section(tileCount * sizeof(int64_t));
+            sections.aliasThreshold = section(tileCount * sizeof(uint32_t));
+            sections.aliasTile = section(tileCount * sizeof(uint32_t));
+            sections.adjacencyMasks = section(directionCount * tileCount * maskWords * sizeof(uint64_t));
+            sections.compatibleOffsets = section((directionCount * tileCount + 1) * sizeof(uint32_t));
+            sections.compatibleTiles = section(compatibleCount * sizeof(uint32_t));
+            sections.initialSupport = section(directionCount * tileCount * sizeof(uint32_t));
+            sections.nameOffsets = section((tileCount + 1) * sizeof(uint32_t));
+            sections.nameOrder = section(tileCount * sizeof(uint32_t));
+            sections.names = section(nameBytes);
+            sections.size = at;
+            return sections;
+        }
 
-            // Is not collapsed and no error
-            mCollapsed = false;
-            mError = false;
+        // Over 64 bit words, the padding makes the blob a multiple of 8 bytes
+        static uint64_t checksum(const uint8_t* data, size_t size){
+            uint64_t hash = 0xcbf29ce484222325ull;
+            for (size_t i=0; i + 8 <= size; i += 8) {
+                uint64_t word;
+                std::memcpy(&word, data + i, sizeof(word));
+                hash = (hash ^ word) * 0x100000001b3ull;
+                hash ^= hash >> 29;
+            }
+            return hash;
+        }
 
-            // Random generator
-            if(seed >= 0){
-                gen = std::mt19937(seed);
-            } else {
-                gen = std::mt19937(rd());
+        template<typename T>
+        static std::span<const T> view(const uint8_t* blob, size_t offset, size_t count){
+            return std::span<const T>(reinterpret_cast<const T*>(blob + offset), count);
+        }
+
+        // Point the tables into a blob. The header and the offset tables are always checked, so a blob
+        // can't make the solver read outside of it
+        bool bind(const uint8_t* blob, size_t size, bool verify){
+            if(std::endian::native != std::endian::little or size < sizeof(Header) or reinterpret_cast<uintptr_t>(blob) % 8 != 0){
+                return false;
             }
 
-            // Create template vector with all tiles
-            std::vector<int> templateTiles;
-            templateTiles.reserve(tileset.tiles.size());
-            for (size_t i=0; i < tileset.tiles.size(); i++) {
-                templateTiles.push_back(i);
+            Header header;
+            std::memcpy(&header, blob, sizeof(Header));
+            if(std::memcmp(header.magic, magic, sizeof(magic)) != 0 or header.version != formatVersion
+               or (header.directionCount != 4 and header.directionCount != 6) or header.size != size
+               or header.tileCount >= (uint64_t(1) << 24) or header.nameBytes >= (uint64_t(1) << 32)
+               or header.compatibleCount > header.directionCount * header.tileCount * header.tileCount
+               or (header.maskWords != 0 and (header.maskWords != (header.tileCount + 63) / 64 or header.tileCount > maxMaskTiles))){
+                return false;
             }
 
-            // Create the grid
-            grid.resize(width, height);
+            size_t directions = header.directionCount;
+            Layout sections = layout(directions, header.tileCount, header.maskWords, header.compatibleCount, header.nameBytes);
+            if(sections.size != size){
+                return false;
+            }
+            if(verify and checksum(blob + sizeof(Header), size - sizeof(Header)) != header.checksum){
+                return false;
+            }
+
+            size_t count = header.tileCount;
+            auto offsets = view<uint32_t>(blob, sections.compatibleOffsets, directions * count + 1);
+            auto nameOffsets = view<uint32_t>(blob, sections.nameOffsets, count + 1);
+            auto nameOrder = view<uint32_t>(blob, sections.nameOrder, count);
+            if(offsets[0] != 0 or offsets.back() != header.compatibleCount or nameOffsets[0] != 0 or nameOffsets.back() != header.nameBytes){
+                return false;
+            }
+            for (size_t i=1; i < offsets.size(); i++) {
+                if(offsets[i] < offsets[i - 1]) return false;
+            }
+            for (size_t i=1; i < nameOffsets.size(); i++) {
+                if(nameOffsets[i] < nameOffsets[i - 1]) return false;
+            }
+            for (uint32_t tile : nameOrder) {
+                if(tile >= count) return false;
+            }
 
-            // Initialize each cell to be in superposition
-            for (int x=0; x < grid.getX(); x++) {
-                for (int y=0; y < grid.getY(); y++) {
-                    grid(x,y).x = x;
-                    grid(x,y).y = y;
-                    grid(x,y).possibleTiles = templateTiles;
-                    grid(x,y).collapsed = false;
+            auto compatible = view<uint32_t>(blob, sections.compatibleTiles, header.compatibleCount);
+            auto aliases = view<uint32_t>(blob, sections.aliasTile, count);
+            if(verify){
+                for (uint32_t tile : compatible) {
+                    if(tile >= count) return false;
+                }
+                for (uint32_t tile : aliases) {
+                    if(tile >= count) return false;
                 }
             }
+
+            directionCount = directions;
+            tileCount = count;
+            words = (count + 63) / 64;
+            sumWeight = header.sumWeight;
+            sumWeightLogWeight = header.sumWeightLogWeight;
+            weights = view<double>(blob, sections.weights, count);
+            fixedWeights = view<int64_t>(blob, sections.fixedWeights, count);
+            weightLogWeight = view<int64_t>(blob, sections.weightLogWeight, count);
+            aliasThreshold = view<uint32_t>(blob, sections.aliasThreshold, count);
+            aliasTile = aliases;
+            adjacencyMasks = view<uint64_t>(blob, sections.adjacencyMasks, directions * count * header.maskWords);
+            compatibleOffsets = offsets;
+            compatibleTiles = compatible;
+            initialSupport = view<uint32_t>(blob, sections.initialSupport, directions * count);
+            mNameOffsets = nameOffsets;
+            mNameOrder = nameOrder;
+            mNames = view<char>(blob, sections.names, header.nameBytes);
+            mBlob = std::span<const uint8_t>(blob, size);
+            return true;
         }
+    };
 
-        // Solve the grid for n steps and do a maximum of n backtracks; count -1 = solve until done; backtrack 0 = no backtracking
-        bool solve(int count, int backtrack){
-            std::cout << "- Solve" << std::endl;
+    // Kernels for the bitset propagator working on packed domains. The best version the CPU supports is
+    // picked at runtime, builds for other platforms or with LUFUWFC_NO_SIMD only have the scalar one
+    namespace simd{
+        enum class Level{
+            Scalar,
+            AVX2,
+            AVX512 // AVX-512F with VPOPCNTDQ
+        };
+
+        struct Kernels{
+            Level level;
+            // dst = union of the masks of every tile in domain. masks holds words words per tile
+            void (*unionOfMasks)(uint64_t* dst, const uint64_t* domain, const uint64_t* masks, size_t words);
+            // Number of tiles of domain that are not in valid, 0 if an intersection wouldn't change the domain
+            size_t (*countRemoved)(const uint64_t* domain, const uint64_t* valid, size_t words);
+        };
+
+        inline void unionOfMasksScalar(uint64_t* dst, const uint64_t* domain, const uint64_t* masks, size_t words){
+            std::fill(dst, dst + words, 0);
+            for (size_t w=0; w < words; w++) {
+                for (uint64_t bits=domain[w]; bits; bits &= bits - 1) {
+                    const uint64_t* mask = masks + (w * 64 + std::countr_zero(bits)) * words;
+                    for (size_t v=0; v < words; v++) {
+                        dst[v] |= mask[v];
+                    }
+                }
+            }
+        }
 
-            while (count != 0) {
-                // Reset Backtracker
-                tracker.reset();
+        inline size_t countRemovedScalar(const uint64_t* domain, const uint64_t* valid, size_t words){
+            size_t count = 0;
+            for (size_t w=0; w < words; w++) {
+                count += std::popcount(domain[w] & ~valid[w]);
+            }
+            return count;
+        }
 
-                // If already done, do nothing
-                if(mCollapsed){
-                    count = 0;
-                    std::cout << "  Nothing to do" << std::endl;
-                    break;
+#ifdef LUFUWFC_X86_SIMD
+        // The domain is walked once per block of 16 words, so up to 1024 tiles stay in four registers
+        __attribute__((target("avx2"))) inline void unionOfMasksAVX2(uint64_t* dst, const uint64_t* domain, const uint64_t* masks, size_t words){
+            size_t v = 0;
+            for (; v + 16 <= words; v += 16) {
+                __m256i a = _mm256_setzero_si256(), b = a, c = a, d = a;
+                for (size_t w=0; w < words; w++) {
+                    for (uint64_t bits=domain[w]; bits; bits &= bits - 1) {
+                        const uint64_t* mask = masks + (w * 64 + std::countr_zero(bits)) * words + v;
+                        a = _mm256_or_si256(a, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(mask)));
+                        b = _mm256_or_si256(b, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(mask + 4)));
+                        c = _mm256_or_si256(c, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(mask + 8)));
+                        d = _mm256_or_si256(d, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(mask + 12)));
+                    }
                 }
-
-                // Do one step and reduce count
-                step();
-                if (count > 0) {
-                    count --;
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + v), a);
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + v + 4), b);
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + v + 8), c);
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + v + 12), d);
+            }
+            for (; v + 4 <= words; v += 4) {
+                __m256i a = _mm256_setzero_si256();
+                for (size_t w=0; w < words; w++) {
+                    for (uint64_t bits=domain[w]; bits; bits &= bits - 1) {
+                        const uint64_t* mask = masks + (w * 64 + std::countr_zero(bits)) * words + v;
+                        a = _mm256_or_si256(a, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(mask)));
+                    }
                 }
-                
-                // Check if an error occured and try backtracking or end solve
-                if(mError){
-                    if(backtrack > 0){
-                        // Go back to last state and try again
-                        tracker.revert(grid);
-
-                        mError = false;
-                        backtrack --;
-                        std::cout << "  No Possible Tiles! Backtracking!" <<std::endl;
-                    } else {
-                        // End
-                        std::cout << "  Unsolvable state" << std::endl;
-                        break;
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + v), a);
+            }
+            for (; v < words; v++) {
+                uint64_t a = 0;
+                for (size_t w=0; w < words; w++) {
+                    for (uint64_t bits=domain[w]; bits; bits &= bits - 1) {
+                        a |= masks[(w * 64 + std::countr_zero(bits)) * words + v];
                     }
                 }
+                dst[v] = a;
             }
-
-            return !mError;
         }
 
-        // Place and propagate one tile manually
-        void manualSetCell(size_t x, size_t y, std::string tileName){
+        __attribute__((target("avx2,popcnt"))) inline size_t countRemovedAVX2(const uint64_t* domain, const uint64_t* valid, size_t words){
+            size_t count = 0;
+            size_t w = 0;
+            for (; w + 4 <= words; w += 4) {
+                __m256i removed = _mm256_andnot_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(valid + w)),
+                                                      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(domain + w)));
+                if(!_mm256_testz_si256(removed, removed)){
+                    alignas(32) uint64_t lanes[4];
+                    _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), removed);
+                    count += _mm_popcnt_u64(lanes[0]) + _mm_popcnt_u64(lanes[1]) + _mm_popcnt_u64(lanes[2]) + _mm_popcnt_u64(lanes[3]);
+                }
+            }
+            for (; w < words; w++) {
+                count += _mm_popcnt_u64(domain[w] & ~valid[w]);
+            }
+            return count;
+        }
 
-            if(grid(x,y).collapsed){ std::cout << "  Cell is already collapsed. Can't manually set cell" << std::endl; return; }
+        // Masked loads cover the last partial block, so there is no scalar tail
+        __attribute__((target("avx512f"))) inline void unionOfMasksAVX512(uint64_t* dst, const uint64_t* domain, const uint64_t* masks, size_t words){
+            // Up to 256 tiles fit into one AVX2 register, a masked 512 bit load would only add work
+            if(words <= 4){
+                unionOfMasksAVX2(dst, domain, masks, words);
+                return;
+            }
+            for (size_t v=0; v < words; v += 16) {
+                size_t left = words - v;
+                __mmask8 ma = left >= 8 ? 0xff : static_cast<__mmask8>((1u << left) - 1);
+                __mmask8 mb = left >= 16 ? 0xff : left > 8 ? static_cast<__mmask8>((1u << (left - 8)) - 1) : 0;
+                __m512i a = _mm512_setzero_si512(), b = a;
+                for (size_t w=0; w < words; w++) {
+                    for (uint64_t bits=domain[w]; bits; bits &= bits - 1) {
+                        const uint64_t* mask = masks + (w * 64 + std::countr_zero(bits)) * words + v;
+                        a = _mm512_or_si512(a, _mm512_maskz_loadu_epi64(ma, mask));
+                        b = _mm512_or_si512(b, _mm512_maskz_loadu_epi64(mb, mask + 8));
+                    }
+                }
+                _mm512_mask_storeu_epi64(dst + v, ma, a);
+                _mm512_mask_storeu_epi64(dst + v + 8, mb, b);
+            }
+        }
 
-            // --- Observation ---
-            // Find the cell with the lowest entropy > 1
-            Cell* targetCell = &grid(x,y);
+        __attribute__((target("avx512f,avx512vpopcntdq"))) inline size_t countRemovedAVX512(const uint64_t* domain, const uint64_t* valid, size_t words){
+            __m512i count = _mm512_setzero_si512();
+            for (size_t w=0; w < words; w += 8) {
+                size_t left = words - w;
+                __mmask8 m = left >= 8 ? 0xff : static_cast<__mmask8>((1u << left) - 1);
+                __m512i removed = _mm512_maskz_andnot_epi64(m, _mm512_maskz_loadu_epi64(m, valid + w), _mm512_maskz_loadu_epi64(m, domain + w));
+                count = _mm512_add_epi64(count, _mm512_popcnt_epi64(removed));
+            }
 
-            // Save cell state
-            tracker.saveChange(grid(targetCell->x, targetCell->y));
-            
-            // --- Collapse ---
-            grid(x,y).possibleTiles.clear();
-            grid(x,y).possibleTiles.push_back(mTileset.name_to_index_map[tileName]);
-            grid(x,y).collapsed = true;
+            alignas(64) uint64_t lanes[8];
+            _mm512_store_si512(lanes, count);
+            return lanes[0] + lanes[1] + lanes[2] + lanes[3] + lanes[4] + lanes[5] + lanes[6] + lanes[7];
+        }
+#endif
+
+        inline bool supported(Level level){
+#ifdef LUFUWFC_X86_SIMD
+            __builtin_cpu_init();
+            switch (level) {
+                case Level::AVX512: return __builtin_cpu_supports("avx512f") and __builtin_cpu_supports("avx512vpopcntdq");
+                case Level::AVX2: return __builtin_cpu_supports("avx2") and __builtin_cpu_supports("popcnt");
+                default: return true;
+            }
+#else
+            return level == Level::Scalar;
+#endif
+        }
 
-            // --- Propagation ---
-            propagate(targetCell->x, targetCell->y);
+        inline Kernels kernelsFor([[maybe_unused]] Level level){
+#ifdef LUFUWFC_X86_SIMD
+            if(level == Level::AVX512) return {Level::AVX512, unionOfMasksAVX512, countRemovedAVX512};
+            if(level == Level::AVX2) return {Level::AVX2, unionOfMasksAVX2, countRemovedAVX2};
+#endif
+            return {Level::Scalar, unionOfMasksScalar, countRemovedScalar};
         }
 
-    private:
-        std::mt19937 gen;
-        std::random_device rd;
+        inline Kernels& activeKernels(){
+            static Kernels kernels = kernelsFor(supported(Level::AVX512) ? Level::AVX512 : supported(Level::AVX2) ? Level::AVX2 : Level::Scalar);
+            return kernels;
+        }
 
-        int stepCount;
-        bool mCollapsed = false;
-        bool mError = false;
-        TileSet mTileset;
-        std::array<std::pair<int, int>, 4> directions = {{{0,-1}, {1,0}, {0,1}, {-1,0}}};
-        
-        // This function performs one "Observe & Propagate" cycle.
-        void step(){
+        inline const Kernels& kernels(){
+            return activeKernels();
+        }
 
-            // --- Observation ---
-            // Find the cell with the lowest entropy > 1
-            Cell* targetCell = findLowestEntropyCell();
-            
-            // Check if cell is null if true everything is collapsed
-            if(targetCell == nullptr){
-                mCollapsed = true;
-                std::cout << "- WFC complete" << std::endl;
-                return;
+        // Force a kernel level, e.g. to compare them. Call it before solving, returns false if the CPU lacks it
+        inline bool select(Level level){
+            if(!supported(level)){
+                return false;
             }
-            
-            // Save cell state
-            tracker.saveChange(grid(targetCell->x, targetCell->y));
-
-            // --- Collapse ---
-            collapseCell(targetCell->x, targetCell->y);
-
-            // --- Propagation ---
-            propagate(targetCell->x, targetCell->y);
+            activeKernels() = kernelsFor(level);
+            return true;
+        }
+    }
+
+    // Words is the number of 64 bit words per cell when it is known at compile time, 0 sizes the cells at runtime.
+    // With a fixed size every loop over the words of a cell is unrolled
+    template<size_t Words>
+    struct BasicGrid{
+        size_t mX = 0, mY = 0, mZ = 1;
+        size_t mTileCount = 0;
+        size_t mWords = 0; // 64 bit words per cell
+
+        Topology mTopology;
+        size_t mDirections = 4;
+        std::vector<int32_t> mNeighbors; // Neighbor table of the topology, -1 at the border
+
+        // Structure of arrays wave: one contiguous block of mWords words per cell holding the possible tiles as bits
+        std::vector<uint64_t> mWave;
+        std::vector<uint32_t> mCount; // Cached popcount of every cell
+        std::vector<uint8_t> mCollapsed;
+
+        static constexpr size_t invalid = SIZE_MAX;
+
+        BasicGrid(){}
+        BasicGrid(size_t& x, size_t& y, size_t tileCount){
+            resize(x, y, tileCount);
         }
 
-        // Finds the uncollapsed cell with the fewest options.
-        Cell* findLowestEntropyCell() {
-            size_t minEntropy = SIZE_MAX;
-            std::vector<Cell*> candidateCells;
-
-            // Search lowest entropy cells
-            for (auto& cell : grid.mData) {
+        void resize(const size_t& x, const size_t& y, const size_t& tileCount){
+            resize(Topology::square(x, y), tileCount);
+        }
 
-                // Skip if cell is collapsed
-                if(cell.collapsed){
-                    continue;
-                }
-                
-                if(cell.getEntropy() < minEntropy){
-                    // Found new minimum, discard previous results and add cell
-                    minEntropy = cell.getEntropy();
-                    candidateCells.clear();
-                    candidateCells.push_back(&cell);
-                } else if (cell.getEntropy() == minEntropy) {
-                    // Same minimum add to candidateCells
-                    candidateCells.push_back(&cell);
-                }
-                // If element > current_min, do nothing
+        void resize(const Topology& topology, size_t tileCount){
+            // The neighbor table only changes with the topology
+            if(!(topology == mTopology) or mNeighbors.size() != topology.size() * topology.directionCount()){
+                mTopology = topology;
+                mTopology.buildNeighbors(mNeighbors);
             }
-            
-            // If all cells are collapsed, return nullptr
-            if(candidateCells.empty()){
-                return nullptr;
+            mX = topology.width;
+            mY = topology.height;
+            mZ = topology.depth;
+            mDirections = topology.directionCount();
+            mTileCount = tileCount;
+            mWords = Words ? Words : (tileCount + 63) / 64;
+            mWave.resize(topology.size() * mWords);
+            mCount.resize(topology.size());
+            mCollapsed.resize(topology.size());
+        }
+
+        // Put every cell in superposition
+        void fill(){
+            std::vector<uint64_t> full(mWords, ~uint64_t(0));
+            if(mTileCount % 64 != 0){
+                full[mWords - 1] = (uint64_t(1) << (mTileCount % 64)) - 1;
             }
 
-            if(candidateCells.size() > 1){
-                // Multiple lowest entropy cells pick one randomly
-                return candidateCells[generateRandomInt(0, candidateCells.size() -1)];
-            } else {
-                // Return the only lowest entropy cell
-                return candidateCells[0];
+            for (size_t i=0; i < size(); i++) {
+                std::copy(full.begin(), full.end(), cell(i));
             }
+            std::fill(mCount.begin(), mCount.end(), mTileCount);
+            std::fill(mCollapsed.begin(), mCollapsed.end(), 0);
         }
 
-        // Collapse a specific cell
-        void collapseCell(size_t x, size_t y){
-            Cell& cell = grid(x,y);
-
-            // Random choice
-            std::vector<int> cumulativeWeights;
-            // Reserve space to avoid reallocations
-            cumulativeWeights.reserve(cell.possibleTiles.size());
-
-            // Calculate partial sums
-            int totalWeight = 0;
-            for (const auto& tile : cell.possibleTiles) {
-                totalWeight += mTileset.tiles[tile].weight;
-                cumulativeWeights.push_back(totalWeight);
-            } 
-
-            // Find the first element in range > randomWeight
-            auto it = std::upper_bound(cumulativeWeights.begin(), cumulativeWeights.end(), generateRandomInt(0, totalWeight-1));
-            int index = std::distance(cumulativeWeights.begin(), it);
-            int tileID = cell.possibleTiles[index];
-            
-            // Set cell state permanently
-            cell.possibleTiles.clear();
-            cell.possibleTiles.push_back(tileID);
-            cell.collapsed = true;
+        bool isOutOfBound(const size_t& x, const size_t& y) const {
+            return x < 0 or x >= mX or y < 0 or y >= mY;
         }
 
-        // Propagate the wave from a starting point
-        void propagate(size_t x, size_t y){
-            // Use a stack to keep track of cells whose possibilities have been reduced.
-            // Start with the cell that just collapsed.
-            std::queue<std::pair<int, int>> queue;
-            queue.push({x,y});
-
-            while (!queue.empty()) {
-                std::pair<int, int> pos = queue.front();
-                Cell& currentCell = grid(pos.first, pos.second);
-                queue.pop();
-                
-                // Get all valid neighbors (up, right, down, left)
-                for(auto neighborPos : getNeighbors(currentCell.x, currentCell.y)){
-                    Cell& neighborCell = grid(neighborPos.x, neighborPos.y);
+        int getX() const { return mX; }
+        int getY() const { return mY; }
+        size_t size() const { return mCount.size(); }
 
-                    // Get the list of tiles in the neighbor that are still possible
-                    std::set<int> validTiles = getValidTilesInDirection(currentCell, neighborPos.di);
-                    std::vector<int> newTiles = getIntersectingTiles(neighborCell, validTiles);
+        int index(size_t x, size_t y) const { return mX * y + x; }
+        size_t index(size_t x, size_t y, size_t z) const { return x + mX * (y + mY * z); }
 
-                    // If the state of the neighbor will be changed
-                    if(neighborCell.possibleTiles.size() != newTiles.size()) {
-                        // Save the state of the cell
-                        tracker.saveChange(neighborCell);
+        size_t directionCount() const { return mDirections; }
+        size_t opposite(size_t d) const { return (d + mDirections / 2) % mDirections; }
 
-                        // If the cell has 0 possibilities, we have a contradiction!
-                        if(newTiles.size() == 0){
-                            mError = true;
-                            return;
-                        }
-                        // Update the neighbor's state
-                        neighborCell.possibleTiles = newTiles;
+        // Index of the neighbor in direction d or invalid at the border. -1 converts to invalid without a branch
+        size_t neighbor(size_t i, size_t d) const {
+            return static_cast<size_t>(static_cast<ptrdiff_t>(mNeighbors[i * mDirections + d]));
+        }
 
-                        // Add this neighbor to the queue
-                        queue.push({neighborPos.x, neighborPos.y});
-                    }
-                }
-            }
+        size_t words() const {
+            if constexpr (Words != 0) return Words;
+            else return mWords;
         }
 
-        //---------------- Helpers ----------------
-        // Generate a random int from zero to n -1
-        size_t generateRandomInt(size_t start, size_t end) {
-            // The distribution is created on each call, which is cheap.
-            // This allows the range [0, n] to be different for each call.
-            std::uniform_int_distribution<size_t> distribution(start, end);
+        uint64_t* cell(size_t i){ return &mWave[i * words()]; }
+        const uint64_t* cell(size_t i) const { return &mWave[i * words()]; }
 
-            return distribution(gen);
+        bool hasTile(size_t i, size_t tile) const {
+            return (cell(i)[tile / 64] >> (tile % 64)) & 1;
         }
 
-        // Get all neighbors
-        std::vector<Neighbor> getNeighbors(int x, int y){
-            // Vector that will contain all valid neighbors
-            std::vector<Neighbor> neighbors;
-            
-            for(size_t i=0; i < directions.size(); i++){
-                int nX = x + directions[i].first, nY = y + directions[i].second;
-
-                if(grid.isOutOfBound(nX, nY)) continue; // Skip if cell is out of bound
-                if(grid(nX,nY).collapsed) continue; // Skip if cell is collapse
+        // Remove a tile from a cell and keep the popcount in sync. Returns true if the tile was possible
+        bool removeTile(size_t i, size_t tile){
+            uint64_t& word = cell(i)[tile / 64];
+            uint64_t bit = uint64_t(1) << (tile % 64);
+            if(!(word & bit)){
+                return false;
+            }
+            word &= ~bit;
+            mCount[i]--;
+            return true;
+        }
 
-                neighbors.push_back(Neighbor(nX, nY, i));
+        // Make a tile possible again. Returns true if the tile was not possible before
+        bool addTile(size_t i, size_t tile){
+            uint64_t& word = cell(i)[tile / 64];
+            uint64_t bit = uint64_t(1) << (tile % 64);
+            if(word & bit){
+                return false;
             }
-            
-            return neighbors;
+            word |= bit;
+            mCount[i]++;
+            return true;
         }
 
-        // Get all valid tiles from a cell in the specified directions
-        std::set<int> getValidTilesInDirection(Cell& cell, size_t direction){
-            std::set<int> validTiles;
+        // Reduce a cell to exactly one tile
+        void setTile(size_t i, size_t tile){
+            std::fill(cell(i), cell(i) + words(), 0);
+            cell(i)[tile / 64] = uint64_t(1) << (tile % 64);
+            mCount[i] = 1;
+        }
 
-            // Add all rules from every possibleTile from the cell in the direction together
-            for(auto& tile : cell.possibleTiles){
-                for(auto& rule : mTileset.tiles[tile].adjacency[direction]){
-                    validTiles.insert(rule);
+        // Returns the first possible tile of a cell or -1 if there is none
+        int firstTile(size_t i) const {
+            const uint64_t* domain = cell(i);
+            for (size_t w=0; w < words(); w++) {
+                if(domain[w]){
+                    return w * 64 + std::countr_zero(domain[w]);
                 }
             }
-
-            return validTiles;
+            return -1;
         }
 
-        // Return intersecting tiles from a cell and tiles vector
-        std::vector<int> getIntersectingTiles(Cell& cell, std::set<int>& validTiles){
-            std::vector<int> intersections;
-            for(auto& neighborTile : cell.possibleTiles){
-                if(validTiles.count(neighborTile)){
-                    intersections.push_back(neighborTile);
+        // Call f(tile) for every possible tile of a cell
+        template<typename F>
+        void forEachTile(size_t i, F&& f) const {
+            const uint64_t* domain = cell(i);
+            for (size_t w=0; w < words(); w++) {
+                uint64_t bits = domain[w];
+                while (bits) {
+                    f(w * 64 + std::countr_zero(bits));
+                    bits &= bits - 1;
                 }
             }
-            return intersections;
         }
+
+        size_t getEntropy(size_t i) const { return mCount[i]; }
+        bool isCollapsed(size_t i) const { return mCollapsed[i]; }
+
+        size_t getEntropy(size_t x, size_t y) const { return getEntropy(index(x, y)); }
+        bool isCollapsed(size_t x, size_t y) const { return isCollapsed(index(x, y)); }
+        int getTile(size_t x, size_t y) const { return firstTile(index(x, y)); }
+    };
+
+    using Grid = BasicGrid<0>;
+
+    // Largest number of words per cell that gets its own solver, see withSolverWords
+    inline constexpr size_t maxFixedWords = 4;
+
+    // Solved tiles of a map, -1 for cells without a tile
+    struct TileMap{
+        size_t mX = 0, mY = 0, mZ = 1;
+        std::vector<int32_t> mTiles;
+
+        void resize(size_t x, size_t y, size_t z = 1){
+            mX = x;
+            mY = y;
+            mZ = z;
+            mTiles.assign(x * y * z, -1);
+        }
+
+        int32_t& operator()(size_t x, size_t y){ return mTiles[mX * y + x]; }
+        const int32_t& operator()(size_t x, size_t y) const { return mTiles[mX * y + x]; }
+        int32_t& operator()(size_t x, size_t y, size_t z){ return mTiles[x + mX * (y + mY * z)]; }
+        const int32_t& operator()(size_t x, size_t y, size_t z) const { return mTiles[x + mX * (y + mY * z)]; }
     };
+
+    // Varints and raw values in a byte buffer, used for solver snapshots
+    struct ByteWriter{
+        std::vector<uint8_t>& out;
+
+        void varint(uint64_t value){
+            while (value >= 0x80) {
+                out.push_back(static_cast<uint8_t>(value) | 0x80);
+                value >>= 7;
+            }
+            out.push_back(static_cast<uint8_t>(value));
+        }
+
+        // Small signed numbers stay small
+        void zigzag(int64_t value){
+            varint((static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+        }
+
+        void bytes(const void* data, size_t size){
+            const uint8_t* begin = static_cast<const uint8_t*>(data);
+            out.insert(out.end(), begin, begin + size);
+        }
+
+        template<typename T>
+        void value(const T& data){
+            static_assert(std::is_trivially_copyable_v<T>);
+            bytes(&data, sizeof(T));
+        }
+    };
+
+    // Reads what ByteWriter wrote. Reading past the end returns zeros and clears ok
+    struct ByteReader{
+        std::span<const uint8_t> data;
+        size_t at = 0;
+        bool ok = true;
+
+        uint64_t varint(){
+            uint64_t value = 0;
+            for (size_t shift=0; shift < 64; shift += 7) {
+                if(at >= data.size()){
+                    break;
+                }
+                uint8_t byte = data[at++];
+                value |= uint64_t(byte & 0x7f) << shift;
+                if(!(byte & 0x80)){
+                    return value;
+                }
+            }
+            ok = false;
+            return 0;
+        }
+
+        int64_t zigzag(){
+            uint64_t value = varint();
+            return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+        }
+
+        bool bytes(void* dst, size_t size){
+            if(!ok or size > data.size() - at){
+                ok = false;
+                return false;
+            }
+            if(size > 0) std::memcpy(dst, data.data() + at, size);
+            at += size;
+            return true;
+        }
+
+        template<typename T>
+        T value(){
+            static_assert(std::is_trivially_copyable_v<T>);
+            T result{};
+            bytes(&result, sizeof(T));
+            return result;
+        }
+    };
+
+    // Undo log of the wave. Every removed tile is appended to the trail and every decision (a collapsed cell)
+    // marks where its level starts, so reverting to any level only touches what changed since then
+    struct BackTracker{
+        static constexpr uint32_t none = UINT32_MAX;
+        static constexpr uint32_t banFlag = uint32_t(1) << 31;
+
+        struct Removal{
+            uint32_t cell;
+            uint32_t tile; // The high bit marks a tile banned after its decision failed
+            uint32_t prev; // Previous removal of the same cell or none
+
+            size_t getTile() const { return tile & ~banFlag; }
+            bool isBan() const { return tile & banFlag; }
+        };
+
+        struct Decision{
+            uint32_t cell;
+            uint32_t tile;
+            size_t trailStart; // Size of the trail before the decision was applied
+        };
+
+        std::vector<Removal> trail;
+        std::vector<Decision> decisions;
+        std::vector<uint32_t> lastRemoval; // Newest removal of every cell, the removals of a cell form a list
+
+        // Levels responsible for every ban on the trail, stored flat
+        std::vector<size_t> banTrailIndex;
+        std::vector<size_t> banReasonStart;
+        std::vector<uint32_t> banReasons;
+
+        void reset(size_t cellCount){
+            trail.clear();
+            decisions.clear();
+            lastRemoval.assign(cellCount, none);
+            banTrailIndex.clear();
+            banReasonStart.clear();
+            banReasons.clear();
+        }
+
+        size_t level() const { return decisions.size(); }
+
+        void saveRemoval(size_t cell, size_t tile){
+            trail.push_back({static_cast<uint32_t>(cell), static_cast<uint32_t>(tile), lastRemoval[cell]});
+            lastRemoval[cell] = trail.size() - 1;
+        }
+
+        // Mark the newest removal as ban and remember the levels that caused it
+        template<typename It>
+        void markBan(It reasonBegin, It reasonEnd){
+            trail.back().tile |= banFlag;
+            banTrailIndex.push_back(trail.size() - 1);
+            banReasonStart.push_back(banReasons.size());
+            banReasons.insert(banReasons.end(), reasonBegin, reasonEnd);
+        }
+
+        // Remove the newest removal from the trail and return it
+        Removal popRemoval(){
+            Removal removal = trail.back();
+            trail.pop_back();
+            lastRemoval[removal.cell] = removal.prev;
+
+            if(removal.isBan()){
+                banReasons.resize(banReasonStart.back());
+                banReasonStart.pop_back();
+                banTrailIndex.pop_back();
+            }
+            return removal;
+        }
+
+        // Make the current wave level 0. Decisions, bans and removals are forgotten, nothing below level 1 is
+        // ever undone. Takes time proportional to the trail, so every removal is paid for once
+        void rebase(){
+            for (const Removal& removal : trail) {
+                lastRemoval[removal.cell] = none;
+            }
+            trail.clear();
+            decisions.clear();
+            banTrailIndex.clear();
+            banReasonStart.clear();
+            banReasons.clear();
+        }
+
+        void saveDecision(size_t cell, size_t tile){
+            decisions.push_back({static_cast<uint32_t>(cell), static_cast<uint32_t>(tile), trail.size()});
+        }
+
+        // Decision level the removal at a trail index was made at
+        uint32_t levelOf(size_t trailIndex) const {
+            auto it = std::upper_bound(decisions.begin(), decisions.end(), trailIndex,
+                [](size_t index, const Decision& decision){ return index < decision.trailStart; });
+            return std::distance(decisions.begin(), it);
+        }
+
+        // Call f(level) for every level that caused the removal at a trail index. Removals that follow a ban on
+        // the same level were propagated from it and share its reasons, the level itself didn't cause them
+        template<typename F>
+        void forEachReason(size_t trailIndex, F&& f) const {
+            size_t ban = std::distance(banTrailIndex.begin(), std::upper_bound(banTrailIndex.begin(), banTrailIndex.end(), trailIndex));
+            uint32_t level = levelOf(trailIndex);
+            if(ban == 0 or levelOf(banTrailIndex[ban - 1]) != level){
+                f(level);
+                return;
+            }
+
+            ban--;
+            size_t end = ban + 1 < banReasonStart.size() ? banReasonStart[ban + 1] : banReasons.size();
+            for (size_t n=banReasonStart[ban]; n < end; n++) {
+                f(banReasons[n]);
+            }
+        }
+    };
+
+    // Controls how solve picks cells and reacts to contradictions
+    struct SearchStrategy{
+        // Breaks ties between cells with the same entropy
+        enum class TieBreak{
+            Noise, // Random noise per cell
+            Scan   // Scan order from a corner picked by the seed. Far fewer contradictions on tight tilesets
+        };
+
+        enum class Restart{
+            None,
+            Luby,     // Restart after base * luby(n) contradictions: 1, 1, 2, 1, 1, 2, 4, ...
+            Geometric // Restart after base * factor^n contradictions
+        };
+
+        TieBreak tieBreak = TieBreak::Noise;
+        // Jump back to the newest decision that caused the contradiction instead of the last one. The cause is
+        // approximated from the removals around the empty cell, which pays off when unrelated decisions pile up
+        // between a bad decision and its contradiction. Off by default, it only costs time on easy tilesets
+        bool backjumping = false;
+        Restart restart = Restart::None;
+        size_t restartBase = 64;
+        double restartFactor = 1.5;
+
+        std::string name() const {
+            std::string result = backjumping ? "backjump" : "chronological";
+            if(restart == Restart::Luby) result += "+luby";
+            if(restart == Restart::Geometric) result += "+geometric";
+            return result;
+        }
+    };
+
+    struct SearchStats{
+        size_t decisions = 0;
+        size_t contradictions = 0;
+        size_t backtracks = 0;
+        size_t skippedLevels = 0; // Levels undone by backjumps beyond the last decision
+        size_t restarts = 0;
+        size_t removedTiles = 0;      // Tiles removed from a domain, one propagation step each
+        double seconds = 0;           // Time spent in solve since initialize
+        double timeToSolution = -1;   // Time spent in solve until the grid was complete, -1 if not solved
+
+        // Only counted when built with LUFUWFC_INSTRUMENT
+        size_t propagations = 0;
+        size_t cellsTouched = 0;      // Cells whose domain shrank, summed over all propagations
+        size_t maxCellsTouched = 0;   // Most cells a single propagation shrank
+        size_t maxQueueDepth = 0;     // Longest propagation queue
+        double observeSeconds = 0;    // Time spent finding the next cell
+        double collapseSeconds = 0;
+        double propagateSeconds = 0;
+    };
+
+    // Limits of one WFC::solveFor call. Work counts decisions and propagation steps, so it bounds a call
+    // independently of the clock
+    struct SolveBudget{
+        double seconds = std::numeric_limits<double>::infinity();
+        size_t work = SIZE_MAX;
+    };
+
+    enum class SolveStatus{
+        Idle,     // No time sliced solve was started since initialize
+        Running,  // The budget ran out, call solveFor again
+        Solved,
+        Failed,   // The backtrack budget is used up or nothing is left to undo
+        Cancelled
+    };
+
+    struct SolveProgress{
+        SolveStatus status = SolveStatus::Idle;
+        size_t collapsedCells = 0;
+        size_t cellCount = 0;
+
+        double fraction() const { return cellCount ? double(collapsedCells) / cellCount : 1.0; }
+    };
+
+#ifdef LUFUWFC_INSTRUMENT
+    inline constexpr bool instrumented = true;
+#else
+    inline constexpr bool instrumented = false;
+#endif
+
+    // Something the solver did. Collapse and Propagate happen on every step and are only sent when built
+    // with LUFUWFC_INSTRUMENT, the other events are rare and always sent
+    struct SolverEvent{
+        enum class Type{
+            Initialize,    // count = cells
+            Solve,         // solve was called
+            Collapse,      // cell was set to tile, level is the new decision level
+            Propagate,     // count = cells whose domain shrank, removed = tiles removed
+            Contradiction, // cell ran out of tiles
+            Backtrack,     // Jumping back to decision level
+            Restart,
+            Solved,
+            Unsolvable,
+            Message        // Anything else worth reporting, in text
+        };
+
+        Type type;
+        size_t cell = SIZE_MAX;
+        size_t tile = 0;
+        size_t level = 0;
+        size_t count = 0;
+        size_t removed = 0;
+        std::string_view text;
+
+        SolverEvent(Type eventType, size_t eventCell = SIZE_MAX, size_t eventTile = 0, size_t eventLevel = 0, size_t eventCount = 0)
+            : type(eventType), cell(eventCell), tile(eventTile), level(eventLevel), count(eventCount){}
+    };
+
+    // Receives the events of a solver. It is called from the thread running the solver
+    class SolverSink{
+    public:
+        virtual ~SolverSink() = default;
+        virtual void onEvent(const SolverEvent& event) = 0;
+    };
+
+    // Writes the events as text to the log stream. This is the sink every solver starts with
+    class LogSink : public SolverSink{
+    public:
+        static LogSink& shared(){
+            static LogSink sink;
+            return sink;
+        }
+
+        void onEvent(const SolverEvent& event) override {
+            switch (event.type) {
+                case SolverEvent::Type::Initialize: logger() << "\n--- Initialize WFC ---" << std::endl; break;
+                case SolverEvent::Type::Solve: logger() << "- Solve" << std::endl; break;
+                case SolverEvent::Type::Backtrack: logger() << "  No Possible Tiles! Backtracking!" << std::endl; break;
+                case SolverEvent::Type::Restart: logger() << "  Restarting with a new seed" << std::endl; break;
+                case SolverEvent::Type::Solved: logger() << "- WFC complete" << std::endl; break;
+                case SolverEvent::Type::Unsolvable: logger() << "  Unsolvable state" << std::endl; break;
+                case SolverEvent::Type::Message: logger() << "  " << event.text << std::endl; break;
+                default: break;
+            }
+        }
+    };
+
+    // Forwards every event to a callback
+    class CallbackSink : public SolverSink{
+    public:
+        explicit CallbackSink(std::function<void(const SolverEvent&)> callback): mCallback(std::move(callback)){}
+
+        void onEvent(const SolverEvent& event) override {
+            mCallback(event);
+        }
+
+    private:
+        std::function<void(const SolverEvent&)> mCallback;
+    };
+
+    // Indexed binary min-heap of cells keyed by entropy. Ties are broken by the cell index so the
+    // order doesn't depend on the layout of the heap
+    struct EntropyHeap{
+        static constexpr uint32_t none = UINT32_MAX;
+
+        std::vector<uint32_t> mHeap;
+        std::vector<uint32_t> mPosition; // Position of every cell in mHeap or none
+        std::vector<double> mKey;
+
+        void reset(size_t cellCount){
+            mHeap.clear();
+            mHeap.reserve(cellCount);
+            mPosition.assign(cellCount, none);
+            mKey.assign(cellCount, 0);
+        }
+
+        bool empty() const { return mHeap.empty(); }
+        size_t size() const { return mHeap.size(); }
+        size_t top() const { return mHeap[0]; }
+        bool contains(size_t cell) const { return mPosition[cell] != none; }
+
+        void push(size_t cell, double key){
+            mKey[cell] = key;
+            mPosition[cell] = mHeap.size();
+            mHeap.push_back(cell);
+            siftUp(mHeap.size() - 1);
+        }
+
+        // Add a cell without restoring the heap order, heapify has to follow
+        void append(size_t cell, double key){
+            mKey[cell] = key;
+            mPosition[cell] = mHeap.size();
+            mHeap.push_back(cell);
+        }
+
+        // Restore the heap order after append, linear in the number of cells
+        void heapify(){
+            for (size_t pos=mHeap.size() / 2; pos-- > 0;) {
+                siftDown(pos);
+            }
+        }
+
+        void remove(size_t cell){
+            uint32_t pos = mPosition[cell];
+            if(pos == none) return;
+
+            mPosition[cell] = none;
+            uint32_t last = mHeap.back();
+            mHeap.pop_back();
+            if(pos == mHeap.size()) return;
+
+            // Move the last element into the hole and restore the heap order
+            mHeap[pos] = last;
+            mPosition[last] = pos;
+            siftUp(pos);
+            siftDown(mPosition[last]);
+        }
+
+        void update(size_t cell, double key){
+            mKey[cell] = key;
+            siftUp(mPosition[cell]);
+            siftDown(mPosition[cell]);
+        }
+
+    private:
+        bool less(uint32_t a, uint32_t b) const {
+            return mKey[a] < mKey[b] or (mKey[a] == mKey[b] and a < b);
+        }
+
+        void place(size_t pos, uint32_t cell){
+            mHeap[pos] = cell;
+            mPosition[cell] = pos;
+        }
+
+        void siftUp(size_t pos){
+            uint32_t cell = mHeap[pos];
+            while (pos > 0) {
+                size_t parent = (pos - 1) / 2;
+                if(!less(cell, mHeap[parent])) break;
+                place(pos, mHeap[parent]);
+                pos = parent;
+            }
+            place(pos, cell);
+        }
+
+        void siftDown(size_t pos){
+            uint32_t cell = mHeap[pos];
+            while (true) {
+                size_t child = 2 * pos + 1;
+                if(child >= mHeap.size()) break;
+                if(child + 1 < mHeap.size() and less(mHeap[child + 1], mHeap[child])) child++;
+                if(!less(mHeap[child], cell)) break;
+                place(pos, mHeap[child]);
+                pos = child;
+            }
+            place(pos, cell);
+        }
+    };
+
+    // How constraints are propagated after a tile is removed
+    enum class Propagator{
+        // AC-4: per cell, direction and tile support counters. Cost is proportional to the removed tiles, but the
+        // counters take cells * directions * tiles * 2 bytes. Needed for the parallel propagation
+        SupportCount,
+        // Intersect the neighbor with the union of the adjacency masks. No counters, so it needs far less memory.
+        // The default, it is faster on every tileset size and density of the benchmark
+        Bitset
+    };
+
+    // Threads and buffers of the parallel propagation. Every band of rows belongs to one worker,
+    // removals that change the support in another band are sent to its owner between rounds
+    class BandPropagation{
+    public:
+        struct Message{
+            uint32_t cell;      // Cell the tile was removed from
+            uint32_t tile;
+            uint32_t direction; // Direction of the affected neighbor
+        };
+
+        struct Band{
+            std::vector<std::pair<uint32_t, uint32_t>> pending;
+            std::vector<std::vector<Message>> outbox; // One per receiving band
+            std::vector<Message> inbox;
+            std::vector<std::pair<uint32_t, uint32_t>> removals; // Merged into the trail afterwards
+            std::vector<uint32_t> dirtyCells;
+            size_t received = 0;
+        };
+
+        std::vector<Band> bands;
+        std::barrier<> barrier;
+        std::atomic<bool> conflict{false};
+
+        BandPropagation(size_t threads, std::function<void(size_t)> work): bands(threads), barrier(threads), mWork(std::move(work)){
+            for (Band& band : bands) {
+                band.outbox.resize(threads);
+            }
+            for (size_t i=1; i < threads; i++) {
+                mThreads.emplace_back([this, i]{ loop(i); });
+            }
+        }
+
+        ~BandPropagation(){
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                mStop = true;
+            }
+            mWake.notify_all();
+            for (auto& thread : mThreads) {
+                thread.join();
+            }
+        }
+
+        size_t size() const { return bands.size(); }
+
+        // Run the work for every band and wait for it. The calling thread takes band 0
+        void run(){
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                mRunning = mThreads.size();
+                mGeneration++;
+            }
+            mWake.notify_all();
+            mWork(0);
+
+            std::unique_lock<std::mutex> lock(mMutex);
+            mDone.wait(lock, [this]{ return mRunning == 0; });
+        }
+
+    private:
+        std::function<void(size_t)> mWork;
+        std::vector<std::thread> mThreads;
+        std::mutex mMutex;
+        std::condition_variable mWake;
+        std::condition_variable mDone;
+        size_t mGeneration = 0;
+        size_t mRunning = 0;
+        bool mStop = false;
+
+        void loop(size_t band){
+            size_t seen = 0;
+            std::unique_lock<std::mutex> lock(mMutex);
+            while (true) {
+                mWake.wait(lock, [&]{ return mStop or mGeneration != seen; });
+                if(mStop){
+                    return;
+                }
+                seen = mGeneration;
+
+                lock.unlock();
+                mWork(band);
+                lock.lock();
+
+                if(--mRunning == 0){
+                    mDone.notify_one();
+                }
+            }
+        }
+    };
+
+    // Presolved initial waves shared between solvers. A solver with a cache looks the tileset, topology and
+    // propagator up in initialize and copies the wave instead of presolving it again. Waves are dropped least
+    // recently used first once they take more than maxBytes. Safe to share between threads
+    class PresolveCache{
+    public:
+        // Immutable once inserted. Support counters are not kept, they follow from the wave
+        struct Wave{
+            std::vector<uint64_t> wave;
+            std::vector<uint32_t> count;
+            std::vector<uint8_t> collapsed;
+            std::vector<int64_t> sumWeight;
+            std::vector<int64_t> sumWeightLogWeight;
+            bool error = false;
+
+            size_t bytes() const {
+                return wave.size() * sizeof(uint64_t) + count.size() * sizeof(uint32_t) + collapsed.size()
+                       + (sumWeight.size() + sumWeightLogWeight.size()) * sizeof(int64_t);
+            }
+        };
+
+        explicit PresolveCache(size_t maxBytes = size_t(256) << 20): mMaxBytes(maxBytes){}
+
+        // The wave of a tileset and topology, nullptr if there is none
+        std::shared_ptr<const Wave> find(const CompiledTileSet& tileset, const Topology& topology, bool support){
+            std::lock_guard lock(mMutex);
+            for (Entry& entry : mEntries) {
+                if(entry.matches(tileset, topology, support)){
+                    entry.lastUse = ++mClock;
+                    return entry.wave;
+                }
+            }
+            return nullptr;
+        }
+
+        // Waves larger than maxBytes are not kept
+        void insert(const CompiledTileSet& tileset, const Topology& topology, bool support, std::shared_ptr<const Wave> wave){
+            std::lock_guard lock(mMutex);
+            size_t bytes = wave->bytes();
+            if(bytes > mMaxBytes){
+                return;
+            }
+            for (const Entry& entry : mEntries) {
+                if(entry.matches(tileset, topology, support)) return;
+            }
+            while (mBytes + bytes > mMaxBytes) {
+                auto oldest = std::min_element(mEntries.begin(), mEntries.end(), [](const Entry& a, const Entry& b){ return a.lastUse < b.lastUse; });
+                mBytes -= oldest->wave->bytes();
+                mEntries.erase(oldest);
+            }
+            mEntries.push_back({tileset.contentHash(), tileset.tileCount, topology, support, std::move(wave), ++mClock});
+            mBytes += bytes;
+        }
+
+        size_t bytes() const {
+            std::lock_guard lock(mMutex);
+            return mBytes;
+        }
+
+        void clear(){
+            std::lock_guard lock(mMutex);
+            mEntries.clear();
+            mBytes = 0;
+        }
+
+    private:
+        // Tilesets are told apart by their content, so recompiling a tileset still finds its waves
+        struct Entry{
+            uint64_t hash;
+            size_t tileCount;
+            Topology topology;
+            bool support;
+            std::shared_ptr<const Wave> wave;
+            uint64_t lastUse;
+
+            bool matches(const CompiledTileSet& tileset, const Topology& other, bool otherSupport) const {
+                return hash == tileset.contentHash() and tileCount == tileset.tileCount and topology == other and support == otherSupport;
+            }
+        };
+
+        mutable std::mutex mMutex;
+        std::vector<Entry> mEntries;
+        size_t mMaxBytes;
+        size_t mBytes = 0;
+        uint64_t mClock = 0;
+    };
+
+    // Solver for tilesets of Words * 64 tiles or less that need exactly Words words per cell, Words = 0 takes any
+    // tileset. A fixed size keeps the domains and the propagation mask in std::array and lets the compiler unroll
+    // and inline the bitset operations. withSolverWords picks the right one for a tileset at runtime
+    template<size_t Words = 0>
+    class BasicWFC{
+    public:
+        BasicGrid<Words> grid;
+        BackTracker tracker;
+
+        BasicWFC(){}
+        ~BasicWFC(){}
+
+        // Returns true if wfc generation failed
+        bool failed(){
+            return mError;
+        }
+
+        // Select how contradictions are resolved
+        void setSearchStrategy(const SearchStrategy& strategy){
+            mStrategy = strategy;
+        }
+
+        const SearchStats& getSearchStats(){
+            return mStats;
+        }
+
+        // Send the solver events to sink instead of the log. nullptr drops them
+        void setSink(SolverSink* sink){
+            mSink = sink;
+        }
+
+        // Share presolved initial waves with other solvers, see PresolveCache. nullptr (the default) presolves
+        // on every initialize and keeps nothing
+        void setPresolveCache(std::shared_ptr<PresolveCache> cache){
+            mPresolveCache = std::move(cache);
+        }
+
+        // Record the cells whose domain or collapsed state changes, so a viewer only redraws those. Off by default
+        void setChangeTracking(bool enabled){
+            mTrackChanges = enabled;
+            resetChanges();
+        }
+
+        // Move the cells changed since the last call into cells. Returns true instead if every cell has to be
+        // redrawn, after initialize, restore or enabling the tracking. cells is empty then
+        bool takeChangedCells(std::vector<uint32_t>& cells){
+            cells.clear();
+            for (uint32_t i : mChangedCells) {
+                mChanged[i] = false;
+            }
+            bool all = mAllChanged;
+            if(!all){
+                cells.swap(mChangedCells);
+            }
+            mChangedCells.clear();
+            mAllChanged = false;
+            return all;
+        }
+
+        // solve stops and returns false once the flag is set. Pass nullptr to remove it
+        void setCancelFlag(const std::atomic<bool>* cancel){
+            mCancel = cancel;
+        }
+
+        // Write the first possible tile of every cell into a map, -1 for cells without tiles
+        void getTiles(TileMap& map){
+            map.resize(grid.mX, grid.mY, grid.mZ);
+            for (size_t i=0; i < grid.size(); i++) {
+                map.mTiles[i] = grid.firstTile(i);
+            }
+        }
+
+        // Select the propagation algorithm. Takes effect on the next initialize
+        void setPropagator(Propagator propagator){
+            mPropagator = propagator;
+        }
+
+        // Propagate on several threads once at least threshold removals are pending. Only the support count
+        // propagator runs in parallel, and the result is the same as on one thread
+        void setPropagationThreads(size_t threads, size_t threshold = 4096){
+            mBands.reset();
+            if(threads > 1){
+                mBands = std::make_unique<BandPropagation>(threads, [this](size_t band){ propagateBand(band); });
+            }
+            mParallelThreshold = std::max<size_t>(threshold, 1);
+        }
+
+        // Initialize grid width, height, seed and tileset. Seed -1 is a random seed
+        void initialize(int width, int height, int seed, TileSet& tileset){
+            initialize(Topology::square(width, height), seed, tileset);
+        }
+
+        // Initialize a grid of any topology. The tileset needs the same number of directions. Seed -1 is a random seed
+        void initialize(const Topology& topology, int seed, TileSet& tileset){
+            uint64_t fullSeed = seed >= 0 ? static_cast<uint64_t>(seed) : uint64_t(std::random_device()());
+            initialize(topology, fullSeed, std::make_shared<const CompiledTileSet>(tileset));
+        }
+
+        // Initialize with a compiled tileset. The tileset is shared, not copied. Every 64 bit seed gives its own map
+        void initialize(int width, int height, uint64_t seed, std::shared_ptr<const CompiledTileSet> tileset){
+            initialize(Topology::square(width, height), seed, std::move(tileset));
+        }
+
+        void initialize(const Topology& topology, uint64_t seed, std::shared_ptr<const CompiledTileSet> tileset){
+            // Set stepCount to zero
+            stepCount = 0;
+
+            // Set tileset
+            mRules = std::move(tileset);
+
+            // Is not collapsed and no error
+            mCollapsed = false;
+            mError = false;
+            mStatus = SolveStatus::Idle;
+            mPropagating = false;
+
+            // A fixed size solver can't take a tileset with another number of words per cell
+            if(Words != 0 and mRules->words != Words){
+                failInitialize("Tileset doesn't fit the domain size of the solver. Can't initialize");
+                return;
+            }
+            if(mRules->directionCount != topology.directionCount()){
+                failInitialize("Tileset doesn't fit the neighborhood of the topology. Can't initialize");
+                return;
+            }
+            if(!topology.valid()){
+                failInitialize("Wrapped hex grids need an even height. Can't initialize");
+                return;
+            }
+            // Without masks only support counts can propagate, and they only fit into 16 bit with less than 65536 tiles
+            if(!mRules->hasMasks() and mRules->tileCount >= 65536){
+                failInitialize("Tileset has too many tiles for support counts and no adjacency masks. Can't initialize");
+                return;
+            }
+
+            // Random generator
+            mSeed = seed;
+            mRandom = Random(mSeed);
+
+            mRestartContradictions = 0;
+
+            // Create the grid
+            grid.resize(topology, mRules->tileCount);
+            reserveScratch();
+
+            // Support counters only fit into 16 bit with less than 65536 tiles, tilesets without masks always use them
+            mUseSupport = (mPropagator == Propagator::SupportCount or !mRules->hasMasks()) && grid.mTileCount < 65536;
+            mPending.clear();
+            mFloor = 0;
+
+            // Put each cell in superposition and remove the tiles that can't be supported. The result only depends
+            // on the tileset, the topology and the propagator, a presolve cache keeps it for the next initialize
+            if(!loadInitialWave()){
+                grid.fill();
+                tracker.reset(grid.size());
+                initializeEntropy();
+                presolve();
+                saveInitialWave();
+            }
+            mStats = SearchStats();
+            tracker.reset(grid.size());
+            mDirty.assign(grid.size(), false);
+            mDirtyCells.clear();
+            resetChanges();
+
+            buildHeap();
+            emit({SolverEvent::Type::Initialize, Grid::invalid, 0, 0, grid.size()});
+        }
+
+        // Solve the grid for n steps and do a maximum of n backtracks; count -1 = solve until done; backtrack 0 = no backtracking
+        bool solve(int count, int backtrack){
+            emit({SolverEvent::Type::Solve});
+            auto start = std::chrono::steady_clock::now();
+            bool solved = true;
+
+            // Finish a propagation a time sliced solve left behind
+            continuePropagation();
+            if(mError and !mCollapsed and !resolveContradiction(backtrack)){
+                emit({SolverEvent::Type::Unsolvable});
+                count = 0;
+                solved = false;
+            }
+
+            while (count != 0) {
+                // If already done, do nothing
+                if(mCollapsed){
+                    count = 0;
+                    message("Nothing to do");
+                    break;
+                }
+
+                if(mCancel and mCancel->load(std::memory_order_relaxed)){
+                    solved = false;
+                    break;
+                }
+
+                // Do one step and reduce count
+                step();
+                if (count > 0) {
+                    count --;
+                }
+                
+                // Check if an error occured and try backtracking or end solve
+                if(mError and !resolveContradiction(backtrack)){
+                    // End
+                    emit({SolverEvent::Type::Unsolvable});
+                    solved = false;
+                    break;
+                }
+            }
+
+            mStats.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if(mCollapsed and mStats.timeToSolution < 0){
+                mStats.timeToSolution = mStats.seconds;
+            }
+            return solved and !mError;
+        }
+
+        // Start a time sliced solve with a maximum of backtrack backtracks. solveFor does the work, so a caller
+        // with a frame budget can spread a solve over many frames
+        void beginSolve(int backtrack){
+            emit({SolverEvent::Type::Solve});
+            mBacktrackLeft = backtrack;
+            mStatus = !mCollapsed ? SolveStatus::Running : mError ? SolveStatus::Failed : SolveStatus::Solved;
+        }
+
+        // Continue the solve until it ends or the budget runs out. Propagation stops in the middle of a cascade too,
+        // so one call takes about budget.seconds even if a single collapse touches the whole grid
+        SolveStatus solveFor(const SolveBudget& budget){
+            if(mStatus != SolveStatus::Running){
+                return mStatus;
+            }
+            auto start = std::chrono::steady_clock::now();
+            size_t work = budget.work;
+
+            while (mStatus == SolveStatus::Running) {
+                if(mCancel and mCancel->load(std::memory_order_relaxed)){
+                    mStatus = SolveStatus::Cancelled;
+                    break;
+                }
+                // The clock is read once per slice
+                if(work == 0 or std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() >= budget.seconds){
+                    break;
+                }
+
+                mWork = std::min(work, sliceWork);
+                size_t slice = mWork;
+                advance();
+                work -= slice - mWork;
+                mWork = SIZE_MAX;
+            }
+
+            mStats.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if(mStatus == SolveStatus::Solved and mStats.timeToSolution < 0){
+                mStats.timeToSolution = mStats.seconds;
+            }
+            return mStatus;
+        }
+
+        // Stop the time sliced solve. The grid keeps its state, beginSolve continues from there
+        void cancelSolve(){
+            if(mStatus == SolveStatus::Running){
+                mStatus = SolveStatus::Cancelled;
+            }
+        }
+
+        SolveProgress getProgress() const {
+            return {mStatus, grid.size() - mHeap.size(), grid.size()};
+        }
+
+        // Undo the last decision
+        void revert(){
+            if(tracker.level() > 0){
+                revertTo(tracker.level() - 1);
+            }
+        }
+
+        // Undo every decision above level. Takes time proportional to the tiles removed since then
+        void revertTo(size_t level){
+            if(level >= tracker.level()){
+                return;
+            }
+
+            undoRemovals(tracker.decisions[level].trailStart);
+
+            for (size_t n=level; n < tracker.decisions.size(); n++) {
+                size_t cell = tracker.decisions[n].cell;
+                grid.mCollapsed[cell] = false;
+                markChanged(cell);
+                mHeap.push(cell, getEntropy(cell));
+            }
+            tracker.decisions.resize(level);
+            mFloor = std::min(mFloor, level);
+
+            mPending.clear();
+            mPropagating = false;
+            updateEntropies();
+
+            mCollapsed = false;
+            mError = false;
+        }
+
+        // Number of decisions on the stack
+        size_t getDecisionLevel(){
+            return tracker.level();
+        }
+
+        // Place and propagate one tile manually
+        void manualSetCell(size_t x, size_t y, std::string tileName){
+            int tile = mRules->findTile(tileName);
+            if(tile < 0){ message("Unknown tile " + tileName + ". Can't manually set cell"); return; }
+            manualSetCell(x, y, static_cast<size_t>(tile));
+        }
+
+        // Place and propagate one tile by index. failed() is true afterwards if the tile isn't possible there
+        void manualSetCell(size_t x, size_t y, size_t tile){
+            if(x >= grid.mX or y >= grid.mY){ message("Cell is outside of the grid. Can't manually set cell"); return; }
+            if(tile >= grid.mTileCount){ message("Unknown tile " + std::to_string(tile) + ". Can't manually set cell"); return; }
+            size_t targetCell = grid.index(x, y);
+            continuePropagation();
+
+            if(grid.isCollapsed(targetCell)){ message("Cell is already collapsed. Can't manually set cell"); return; }
+
+            // --- Collapse ---
+            tracker.saveDecision(targetCell, tile);
+            setCell(targetCell, tile);
+            mFloor = tracker.level();
+
+            // --- Propagation ---
+            propagate(targetCell);
+        }
+
+        // Solve the rectangle x, y, width, height again (in every layer) and keep the rest of the grid. The region
+        // goes back to superposition, is made consistent with the fixed cells around it and solved with a maximum
+        // of backtrack backtracks. If that fails the region grows by half its size on every side, up to attempts times.
+        // The work is proportional to the region, but the decisions of earlier solves can't be reverted afterwards.
+        // Returns true if the grid is solved again
+        bool regenerate(size_t x, size_t y, size_t width, size_t height, int backtrack, size_t attempts = 4){
+            if(grid.size() == 0){
+                return false;
+            }
+            continuePropagation();
+            mStatus = SolveStatus::Idle;
+
+            size_t x1 = std::min(x + width, grid.mX), y1 = std::min(y + height, grid.mY);
+            x = std::min(x, x1);
+            y = std::min(y, y1);
+            for (size_t attempt=0; attempt < attempts; attempt++) {
+                if(resetRegion(x, y, x1, y1) and solve(-1, backtrack)){
+                    return true;
+                }
+                if(x == 0 and y == 0 and x1 == grid.mX and y1 == grid.mY){
+                    break;
+                }
+                // Grow by half the size on every side
+                size_t growX = std::max<size_t>((x1 - x) / 2, 1), growY = std::max<size_t>((y1 - y) / 2, 1);
+                x = x > growX ? x - growX : 0;
+                y = y > growY ? y - growY : 0;
+                x1 = std::min(x1 + growX, grid.mX);
+                y1 = std::min(y1 + growY, grid.mY);
+                message("Region is unsolvable. Growing it");
+            }
+            return false;
+        }
+
+        // Write the whole solver state into out: wave, random generator, trail, decisions and a propagation that is
+        // still running. Solved cells take a few bytes and the trail is delta coded, the support counters and the
+        // entropies are recomputed by restore. Returns false if the solver isn't initialized
+        bool snapshot(std::vector<uint8_t>& out) const {
+            out.clear();
+            if(!mRules or grid.size() == 0){
+                return false;
+            }
+            ByteWriter writer{out};
+            writer.bytes(snapshotMagic, sizeof(snapshotMagic));
+            writer.varint(snapshotVersion);
+            writer.value(mRules->contentHash());
+            writer.varint(grid.mTileCount);
+
+            const Topology& topology = grid.mTopology;
+            writer.varint(static_cast<uint64_t>(topology.neighborhood));
+            writer.varint(topology.width);
+            writer.varint(topology.height);
+            writer.varint(topology.depth);
+            writer.varint(topology.wrap);
+
+            writer.varint(mSeed);
+            writer.zigzag(stepCount);
+            writer.varint(mCollapsed | mError << 1 | mUseSupport << 2 | mPropagating << 3 | mParallel << 4);
+            writer.varint(static_cast<uint64_t>(mStatus));
+            writer.zigzag(mBacktrackLeft);
+            writer.varint(mFloor);
+            writer.varint(mRestartContradictions);
+            writer.varint(mConflictCell);
+            writer.varint(mPropagationStart);
+            writer.varint(mPropagationTrailStart);
+            writer.varint(mPropagationRemovedBefore);
+            writeStrategy(writer, mStrategy);
+            writeStats(writer, mStats);
+
+            writer.value(mRandom.state());
+
+            // Every cell as its number of tiles, followed by the tile for one tile or the words for a partial domain
+            for (size_t i=0; i < grid.size(); i++) {
+                size_t count = grid.getEntropy(i);
+                writer.varint(count);
+                if(count == 1){
+                    writer.varint(grid.firstTile(i));
+                } else if(count > 1 and count < grid.mTileCount){
+                    writer.bytes(grid.cell(i), grid.words() * sizeof(uint64_t));
+                }
+            }
+            for (size_t i=0; i < grid.size(); i += 8) {
+                uint8_t bits = 0;
+                for (size_t n=i; n < std::min(i + 8, grid.size()); n++) {
+                    bits |= grid.mCollapsed[n] << (n - i);
+                }
+                writer.varint(bits);
+            }
+            writer.bytes(mNoise.data(), mNoise.size() * sizeof(double));
+
+            // Consecutive removals are mostly close to each other
+            writer.varint(tracker.trail.size());
+            size_t previous = 0;
+            for (const BackTracker::Removal& removal : tracker.trail) {
+                writer.zigzag(static_cast<int64_t>(removal.cell) - static_cast<int64_t>(previous));
+                writer.varint(removal.tile);
+                previous = removal.cell;
+            }
+            writer.varint(tracker.decisions.size());
+            for (const BackTracker::Decision& decision : tracker.decisions) {
+                writer.varint(decision.cell);
+                writer.varint(decision.tile);
+                writer.varint(decision.trailStart);
+            }
+            writeList(writer, tracker.banTrailIndex);
+            writeList(writer, tracker.banReasonStart);
+            writeList(writer, tracker.banReasons);
+
+            writeList(writer, mDirtyCells);
+            writer.varint(mQueueSize);
+            for (size_t n=0; n < mQueueSize; n++) {
+                writer.varint(mQueue[(mQueueHead + n) % mQueue.size()]);
+            }
+            writePairs(writer, mPending);
+            writePairs(writer, mParallel ? mPendingStart : std::vector<std::pair<uint32_t, uint32_t>>());
+            return true;
+        }
+
+        // Continue from a snapshot. The tileset has to be the one the snapshot was taken with. Solving on
+        // from here gives exactly what the solver that took the snapshot would have given.
+        // Returns false if the data is not a valid snapshot for this tileset, the solver is unusable then
+        bool restore(std::span<const uint8_t> data, std::shared_ptr<const CompiledTileSet> tileset){
+            ByteReader reader{data};
+            char head[sizeof(snapshotMagic)] = {};
+            reader.bytes(head, sizeof(head));
+            if(!reader.ok or std::memcmp(head, snapshotMagic, sizeof(head)) != 0 or reader.varint() != snapshotVersion){
+                return false;
+            }
+            if(reader.value<uint64_t>() != tileset->contentHash() or reader.varint() != tileset->tileCount
+               or (Words != 0 and tileset->words != Words)){
+                return false;
+            }
+
+            Topology topology;
+            uint64_t neighborhood = reader.varint();
+            topology.neighborhood = static_cast<Neighborhood>(neighborhood);
+            topology.width = reader.varint();
+            topology.height = reader.varint();
+            topology.depth = reader.varint();
+            topology.wrap = reader.varint();
+            if(!reader.ok or neighborhood > static_cast<uint64_t>(Neighborhood::Hex) or topology.directionCount() != tileset->directionCount or !topology.valid()
+               or topology.size() == 0 or topology.size() >= (uint64_t(1) << 32) or topology.size() / topology.width / topology.height != topology.depth){
+                return false;
+            }
+
+            mRules = std::move(tileset);
+            mSeed = reader.varint();
+            stepCount = reader.zigzag();
+            uint64_t flags = reader.varint();
+            mCollapsed = flags & 1;
+            mError = flags & 2;
+            mUseSupport = flags & 4;
+            if(mUseSupport ? mRules->tileCount >= 65536 : !mRules->hasMasks()){
+                return false;
+            }
+            mPropagating = flags & 8;
+            mParallel = (flags & 16) and mBands != nullptr;
+            mStatus = static_cast<SolveStatus>(std::min<uint64_t>(reader.varint(), static_cast<uint64_t>(SolveStatus::Cancelled)));
+            mBacktrackLeft = reader.zigzag();
+            mFloor = reader.varint();
+            mRestartContradictions = reader.varint();
+            mConflictCell = reader.varint();
+            mPropagationStart = reader.varint();
+            mPropagationTrailStart = reader.varint();
+            mPropagationRemovedBefore = reader.varint();
+            if(!readStrategy(reader, mStrategy)){
+                return false;
+            }
+            readStats(reader, mStats);
+            mWork = SIZE_MAX;
+
+            mRandom.setState(reader.value<std::array<uint64_t, 4>>());
+            if(!reader.ok){
+                return false;
+            }
+
+            grid.resize(topology, mRules->tileCount);
+            grid.fill();
+            reserveScratch();
+            for (size_t i=0; i < grid.size() and reader.ok; i++) {
+                size_t count = reader.varint();
+                if(count == 1){
+                    size_t tile = reader.varint();
+                    if(tile >= grid.mTileCount) return false;
+                    grid.setTile(i, tile);
+                } else if(count == 0){
+                    std::fill(grid.cell(i), grid.cell(i) + grid.words(), 0);
+                    grid.mCount[i] = 0;
+                } else if(count < grid.mTileCount){
+                    reader.bytes(grid.cell(i), grid.words() * sizeof(uint64_t));
+                    size_t bits = 0;
+                    for (size_t w=0; w < grid.words(); w++) bits += std::popcount(grid.cell(i)[w]);
+                    if(bits != count or (grid.mTileCount % 64 and grid.cell(i)[grid.words() - 1] >> (grid.mTileCount % 64))) return false;
+                    grid.mCount[i] = count;
+                } else if(count > grid.mTileCount){
+                    return false;
+                }
+            }
+            for (size_t i=0; i < grid.size(); i += 8) {
+                uint64_t bits = reader.varint();
+                for (size_t n=i; n < std::min(i + 8, grid.size()); n++) {
+                    grid.mCollapsed[n] = (bits >> (n - i)) & 1;
+                }
+            }
+            // Only a contradiction leaves a cell without tiles, and collapsed cells keep at most their tile
+            for (size_t i=0; i < grid.size(); i++) {
+                if((grid.getEntropy(i) == 0 and !mError) or (grid.isCollapsed(i) and grid.getEntropy(i) > 1)) return false;
+            }
+            mNoise.resize(grid.size());
+            reader.bytes(mNoise.data(), mNoise.size() * sizeof(double));
+
+            size_t cellCount = grid.size();
+            tracker.reset(cellCount);
+            size_t trailSize = reader.varint();
+            size_t previous = 0;
+            for (size_t n=0; n < trailSize and reader.ok; n++) {
+                size_t cell = previous + reader.zigzag();
+                size_t tile = reader.varint();
+                if(cell >= cellCount or (tile & ~BackTracker::banFlag) >= grid.mTileCount) return false;
+                tracker.saveRemoval(cell, tile);
+                previous = cell;
+            }
+            size_t decisionCount = reader.varint();
+            for (size_t n=0; n < decisionCount and reader.ok; n++) {
+                BackTracker::Decision decision;
+                decision.cell = reader.varint();
+                decision.tile = reader.varint();
+                decision.trailStart = reader.varint();
+                if(decision.cell >= cellCount or decision.tile >= grid.mTileCount or decision.trailStart > trailSize
+                   or (!tracker.decisions.empty() and decision.trailStart < tracker.decisions.back().trailStart)) return false;
+                tracker.decisions.push_back(decision);
+            }
+            if(!readList(reader, tracker.banTrailIndex, trailSize) or !readList(reader, tracker.banReasonStart, SIZE_MAX)
+               or !readList(reader, tracker.banReasons, SIZE_MAX) or tracker.banReasonStart.size() != tracker.banTrailIndex.size()){
+                return false;
+            }
+            // The bans are exactly the flagged removals in trail order, each with the levels below it as reasons
+            size_t flagged = 0;
+            for (const BackTracker::Removal& removal : tracker.trail) {
+                flagged += removal.isBan();
+            }
+            if(flagged != tracker.banTrailIndex.size()){
+                return false;
+            }
+            for (size_t ban=0; ban < tracker.banTrailIndex.size(); ban++) {
+                size_t index = tracker.banTrailIndex[ban];
+                size_t start = tracker.banReasonStart[ban];
+                if(!tracker.trail[index].isBan() or (ban > 0 and (index <= tracker.banTrailIndex[ban - 1] or start < tracker.banReasonStart[ban - 1]))
+                   or start > tracker.banReasons.size()){
+                    return false;
+                }
+            }
+            for (uint32_t level : tracker.banReasons) {
+                if(level > tracker.level()) return false;
+            }
+
+            mDirtyCells.clear();
+            mDirty.assign(cellCount, false);
+            if(!readList(reader, mDirtyCells, cellCount)){
+                return false;
+            }
+            for (uint32_t i : mDirtyCells) {
+                mDirty[i] = true;
+            }
+            mQueueHead = 0;
+            if(!readList(reader, mQueue, cellCount) or !readPairs(reader, mPending) or !readPairs(reader, mPendingStart)){
+                return false;
+            }
+            mQueueSize = mQueue.size();
+            mInQueue.assign(cellCount, 0);
+            for (uint32_t i : mQueue) {
+                if(mInQueue[i]) return false;
+                mInQueue[i] = 1;
+            }
+            mQueue.resize(cellCount);
+            if(!reader.ok or mFloor > tracker.level() or mPropagationTrailStart > trailSize){
+                return false;
+            }
+
+            // Everything else follows from the wave
+            mSumWeight.resize(cellCount);
+            mSumWeightLogWeight.resize(cellCount);
+            for (size_t i=0; i < cellCount; i++) {
+                mSumWeight[i] = 0;
+                mSumWeightLogWeight[i] = 0;
+                grid.forEachTile(i, [&](size_t tile){
+                    mSumWeight[i] += mRules->fixedWeights[tile];
+                    mSumWeightLogWeight[i] += mRules->weightLogWeight[tile];
+                });
+            }
+            if(mUseSupport){
+                recomputeSupport();
+            }
+            resetChanges();
+            mHeap.reset(cellCount);
+            for (size_t i=0; i < cellCount; i++) {
+                if(!grid.isCollapsed(i)){
+                    mHeap.push(i, getEntropy(i));
+                }
+            }
+            return true;
+        }
+
+        // snapshot into a file. Returns false if it couldn't be written
+        bool saveSnapshot(const std::string& path){
+            if(!snapshot(mSnapshotBuffer)){
+                return false;
+            }
+            std::ofstream file(path, std::ios::binary);
+            file.write(reinterpret_cast<const char*>(mSnapshotBuffer.data()), mSnapshotBuffer.size());
+            return file.good();
+        }
+
+        // restore from a file written by saveSnapshot, the file is memory mapped where possible
+        bool loadSnapshot(const std::string& path, std::shared_ptr<const CompiledTileSet> tileset){
+            MappedFile file;
+            return file.open(path) and restore(std::span<const uint8_t>(file.data(), file.size()), std::move(tileset));
+        }
+
+    private:
+        Random mRandom;
+
+        int stepCount;
+        bool mCollapsed = false;
+        bool mError = false;
+        size_t mFloor = 0; // Backtracking doesn't revert decisions at or below this level
+        uint64_t mSeed = 0;
+
+        SearchStrategy mStrategy;
+        SearchStats mStats;
+        const std::atomic<bool>* mCancel = nullptr;
+        SolverSink* mSink = &LogSink::shared();
+        size_t mRestartContradictions = 0; // Contradictions since the last restart
+        size_t mConflictCell = Grid::invalid; // Cell that ran out of tiles
+        std::vector<uint32_t> mConflictLevels;
+        std::vector<uint8_t> mConflictLevelSeen; // Marks the levels already in mConflictLevels
+        std::shared_ptr<const CompiledTileSet> mRules;
+
+        Propagator mPropagator = Propagator::Bitset;
+        bool mUseSupport = false;
+
+        // Scratch buffers. They keep their capacity across initialize, so a reused solver stops allocating
+        // once it has seen its largest propagation
+        std::conditional_t<Words == 0, std::vector<uint64_t>, std::array<uint64_t, Words>> mValidTiles{};
+        // Cells waiting in the bitset propagation. A ring of one slot per cell, a cell is only queued once
+        std::vector<uint32_t> mQueue;
+        std::vector<uint8_t> mInQueue;
+        size_t mQueueHead = 0;
+        size_t mQueueSize = 0;
+
+        // Propagation in progress, it stops early once mWork runs out
+        bool mPropagating = false;
+        bool mParallel = false;
+        size_t mPropagationStart = 0;
+        size_t mPropagationTrailStart = 0;
+        size_t mPropagationRemovedBefore = 0;
+        size_t mWork = SIZE_MAX; // Propagation steps left in the current slice
+
+        // Time sliced solve
+        static constexpr size_t sliceWork = 1024; // Work between two reads of the clock
+        static constexpr size_t maxTrailReserve = size_t(1) << 26; // Removals reserved by initialize, 768 MB of address space
+        SolveStatus mStatus = SolveStatus::Idle;
+        int mBacktrackLeft = 0;
+
+        // mSupport[(cell * directionCount + d) * tileCount + tile] counts the tiles of the neighbor in direction
+        // opposite of d that allow tile in direction d. A tile without support gets removed
+        std::vector<uint16_t> mSupport;
+        // Pending removals (cell, tile) whose support dropped to zero
+        std::vector<std::pair<uint32_t, uint32_t>> mPending;
+
+        // Parallel propagation, nullptr when running on one thread
+        std::unique_ptr<BandPropagation> mBands;
+        size_t mParallelThreshold = 4096;
+        std::vector<std::pair<uint32_t, uint32_t>> mPendingStart; // Copy of mPending to repeat a propagation
+
+        // Weighted entropy of a cell is log(sum w) - sum(w log w) / sum w. Both sums are kept per cell
+        std::vector<int64_t> mSumWeight;
+        std::vector<int64_t> mSumWeightLogWeight;
+        std::vector<double> mNoise;
+        // Uncollapsed cells by entropy. Cells whose domain shrank are marked dirty and updated after propagation
+        EntropyHeap mHeap;
+        std::vector<uint8_t> mDirty;
+        std::vector<uint32_t> mDirtyCells;
+
+        // Cells changed since the last takeChangedCells, only recorded with mTrackChanges
+        bool mTrackChanges = false;
+        bool mAllChanged = true;
+        std::vector<uint8_t> mChanged;
+        std::vector<uint32_t> mChangedCells;
+
+        // Presolved waves of earlier initializes, nullptr presolves every time
+        std::shared_ptr<PresolveCache> mPresolveCache;
+        
+        // This function performs one "Observe & Propagate" cycle.
+        void step(){
+            if(!decide()){
+                return;
+            }
+
+            // --- Propagation ---
+            PhaseTimer timer;
+            continuePropagation();
+            timer.lap(mStats.propagateSeconds);
+        }
+
+        // Observe and collapse the cell with the lowest entropy and start its propagation.
+        // Returns false if everything is collapsed
+        bool decide(){
+            PhaseTimer timer;
+
+            // --- Observation ---
+            // Find the cell with the lowest entropy > 1
+            size_t targetCell = findLowestEntropyCell();
+            timer.lap(mStats.observeSeconds);
+            
+            // Check if cell is invalid if true everything is collapsed
+            if(targetCell == Grid::invalid){
+                mCollapsed = true;
+                emit({SolverEvent::Type::Solved});
+                return false;
+            }
+
+            // --- Collapse ---
+            mStats.decisions++;
+            collapseCell(targetCell);
+            timer.lap(mStats.collapseSeconds);
+            if constexpr (instrumented){
+                emit({SolverEvent::Type::Collapse, targetCell, static_cast<size_t>(grid.firstTile(targetCell)), tracker.level()});
+            }
+
+            startPropagation(targetCell);
+            return true;
+        }
+
+        // One slice of a time sliced solve. Runs until mWork is used up or the solve ended
+        void advance(){
+            while (mStatus == SolveStatus::Running and mWork > 0) {
+                if(mPropagating){
+                    continuePropagation();
+                } else if(mError){
+                    if(!backtrackOnce(mBacktrackLeft)){
+                        emit({SolverEvent::Type::Unsolvable});
+                        mStatus = SolveStatus::Failed;
+                    }
+                } else if(mCollapsed or !decide()){
+                    mStatus = SolveStatus::Solved;
+                } else {
+                    mWork--;
+                }
+            }
+        }
+
+        // Adds the time since the last lap to a counter. Does nothing without LUFUWFC_INSTRUMENT
+        struct PhaseTimer{
+            std::chrono::steady_clock::time_point start;
+
+            PhaseTimer(){
+                if constexpr (instrumented) start = std::chrono::steady_clock::now();
+            }
+
+            void lap(double& seconds){
+                if constexpr (instrumented){
+                    auto now = std::chrono::steady_clock::now();
+                    seconds += std::chrono::duration<double>(now - start).count();
+                    start = now;
+                }
+            }
+        };
+
+        void emit(const SolverEvent& event){
+            if(mSink){
+                mSink->onEvent(event);
+            }
+        }
+
+        void message(std::string_view text){
+            SolverEvent event{SolverEvent::Type::Message};
+            event.text = text;
+            emit(event);
+        }
+
+        // Leave the solver empty and failed after initialize rejected its arguments
+        void failInitialize(const char* reason){
+            message(reason);
+            grid.resize(0, 0, Words * 64);
+            mHeap.reset(0);
+            mCollapsed = true;
+            mError = true;
+        }
+
+        // Finds the uncollapsed cell with the lowest entropy.
+        size_t findLowestEntropyCell() {
+            // If all cells are collapsed, return invalid
+            if(mHeap.empty()){
+                return Grid::invalid;
+            }
+            return mHeap.top();
+        }
+
+        // Collapse a specific cell
+        void collapseCell(size_t i){
+            // Random choice by weight. While the cell keeps at least half of the weight, a draw from the alias table
+            // of the full domain lands in the cell at least every second time. Otherwise the tiles of the cell are
+            // walked once, the weight sum of the cell is already known
+            int64_t totalWeight = mSumWeight[i];
+            size_t tileID = 0;
+            if(totalWeight > 0 and totalWeight * 2 >= mRules->sumWeight){
+                do {
+                    tileID = mRules->sample(mRandom.next());
+                } while (!grid.hasTile(i, tileID));
+            } else if(totalWeight > 0){
+                int64_t target = mRandom.below(totalWeight);
+                tileID = findTile(i, [&](size_t tile){ return (target -= mRules->fixedWeights[tile]) < 0; });
+            } else {
+                // No weight left, every tile is as likely
+                size_t target = mRandom.below(grid.getEntropy(i));
+                tileID = findTile(i, [&](size_t){ return target-- == 0; });
+            }
+
+            // Set cell state permanently
+            tracker.saveDecision(i, tileID);
+            setCell(i, tileID);
+        }
+
+        // First possible tile of a cell pred(tile) is true for
+        template<typename P>
+        size_t findTile(size_t i, P&& pred){
+            const uint64_t* domain = grid.cell(i);
+            for (size_t w=0; w < grid.words(); w++) {
+                for (uint64_t bits=domain[w]; bits; bits &= bits - 1) {
+                    size_t tile = w * 64 + std::countr_zero(bits);
+                    if(pred(tile)) return tile;
+                }
+            }
+            return grid.firstTile(i);
+        }
+
+        // Backtrack until the wave is consistent again. Returns false if the budget ran out or nothing can be undone
+        bool resolveContradiction(int& backtrack){
+            while (mError) {
+                if(!backtrackOnce(backtrack)){
+                    return false;
+                }
+                continuePropagation();
+            }
+            return true;
+        }
+
+        // Undo the decisions behind the current contradiction and start propagating the ban or restart.
+        // Returns false if the budget ran out or nothing can be undone
+        bool backtrackOnce(int& backtrack){
+            mStats.contradictions++;
+            emit({SolverEvent::Type::Contradiction, mConflictCell});
+            mRestartContradictions++;
+
+            // Decisions at or below the floor can't be undone, not even by a restart
+            if(backtrack <= 0 or tracker.level() <= mFloor){
+                return false;
+            }
+
+            if(restartDue()){
+                restart();
+                backtrack --;
+                return true;
+            }
+
+            // Find the decision to jump back to. Chronological backtracking always takes the last one
+            size_t target = tracker.level();
+            if(mStrategy.backjumping){
+                collectConflictLevels(mConflictCell);
+                target = mConflictLevels.empty() ? 0 : mConflictLevels.back();
+                // The levels left over caused the contradiction together with the target
+                if(!mConflictLevels.empty()) mConflictLevels.pop_back();
+            } else {
+                mConflictLevels.clear();
+            }
+
+            if(target <= mFloor){
+                if(mStrategy.restart == SearchStrategy::Restart::None){
+                    return false;
+                }
+                restart();
+                backtrack --;
+                return true;
+            }
+
+            // Undo the decision and ban its tile one level up
+            mStats.backtracks++;
+            mStats.skippedLevels += tracker.level() - target;
+            backtrack --;
+            emit({SolverEvent::Type::Backtrack, Grid::invalid, 0, target - 1});
+
+            BackTracker::Decision decision = tracker.decisions[target - 1];
+            revertTo(target - 1);
+
+            removeTile(decision.cell, decision.tile);
+            tracker.markBan(mConflictLevels.begin(), mConflictLevels.end());
+            startPropagation(decision.cell);
+            return true;
+        }
+
+        // Collect the sorted decision levels above the floor whose removals emptied a cell or shrank its neighbors.
+        // This is an approximation of the real cause, it ignores how the removals reached the neighbors
+        void collectConflictLevels(size_t cell){
+            mConflictLevels.clear();
+            auto collect = [&](size_t i){
+                for (uint32_t n=tracker.lastRemoval[i]; n != BackTracker::none; n=tracker.trail[n].prev) {
+                    tracker.forEachReason(n, [&](uint32_t level){
+                        if(level > mFloor and !mConflictLevelSeen[level]){
+                            mConflictLevelSeen[level] = 1;
+                            mConflictLevels.push_back(level);
+                        }
+                    });
+                }
+            };
+
+            collect(cell);
+            for (size_t d=0; d < grid.directionCount(); d++) {
+                size_t n = getNeighbor(cell, d);
+                if(n != Grid::invalid) collect(n);
+            }
+
+            for (uint32_t level : mConflictLevels) {
+                mConflictLevelSeen[level] = 0;
+            }
+            std::sort(mConflictLevels.begin(), mConflictLevels.end());
+        }
+
+        bool restartDue(){
+            if(mStrategy.restart == SearchStrategy::Restart::None){
+                return false;
+            }
+
+            double limit = mStrategy.restartBase;
+            if(mStrategy.restart == SearchStrategy::Restart::Luby){
+                limit *= luby(mStats.restarts + 1);
+            } else {
+                limit *= std::pow(mStrategy.restartFactor, mStats.restarts);
+            }
+            return mRestartContradictions >= limit;
+        }
+
+        // Go back to the floor and continue with a fresh seed
+        void restart(){
+            emit({SolverEvent::Type::Restart});
+            revertTo(mFloor);
+            mError = false;
+            mStats.restarts++;
+            mRestartContradictions = 0;
+
+            mRandom = Random(splitmix64(mSeed + mStats.restarts));
+            buildHeap();
+        }
+
+        // Remove every other tile from a cell and mark it as collapsed
+        void setCell(size_t i, size_t tileID){
+            for (size_t w=0; w < grid.words(); w++) {
+                uint64_t bits = grid.cell(i)[w];
+                while (bits) {
+                    size_t tile = w * 64 + std::countr_zero(bits);
+                    bits &= bits - 1;
+                    if(tile != tileID){
+                        removeTile(i, tile);
+                    }
+                }
+            }
+            grid.mCollapsed[i] = true;
+            markChanged(i);
+            mHeap.remove(i);
+        }
+
+        // Propagate the wave from a starting point
+        void propagate(size_t start){
+            startPropagation(start);
+            continuePropagation();
+        }
+
+        void startPropagation(size_t start){
+            mPropagating = true;
+            mPropagationStart = start;
+            mPropagationTrailStart = tracker.trail.size();
+            mPropagationRemovedBefore = mStats.removedTiles;
+            mParallel = mBands != nullptr;
+            if(mUseSupport){
+                if(mParallel) mPendingStart = mPending;
+            } else {
+                clearQueue();
+                if(start != Grid::invalid) enqueue(start);
+            }
+        }
+
+        void enqueue(size_t i){
+            if(mInQueue[i]){
+                return;
+            }
+            mInQueue[i] = 1;
+            mQueue[(mQueueHead + mQueueSize) % mQueue.size()] = static_cast<uint32_t>(i);
+            mQueueSize++;
+        }
+
+        size_t dequeue(){
+            size_t i = mQueue[mQueueHead];
+            mQueueHead = (mQueueHead + 1) % mQueue.size();
+            mQueueSize--;
+            mInQueue[i] = 0;
+            return i;
+        }
+
+        void clearQueue(){
+            while (mQueueSize > 0) {
+                dequeue();
+            }
+            mQueueHead = 0;
+        }
+
+        // Propagate until the wave is consistent or mWork runs out. Returns false if the propagation isn't done,
+        // calling it again continues where it stopped
+        bool continuePropagation(){
+            if(!mPropagating){
+                return true;
+            }
+            if(!(mUseSupport ? propagateSupport() : propagateBitset())){
+                return false;
+            }
+            mPropagating = false;
+
+            if constexpr (instrumented){
+                size_t touched = mDirtyCells.size();
+                mStats.propagations++;
+                mStats.cellsTouched += touched;
+                mStats.maxCellsTouched = std::max(mStats.maxCellsTouched, touched);
+                SolverEvent event{SolverEvent::Type::Propagate, mPropagationStart};
+                event.count = touched;
+                event.removed = mStats.removedTiles - mPropagationRemovedBefore;
+                emit(event);
+            }
+            updateEntropies();
+            return true;
+        }
+
+        // Remove every tile whose support dropped to zero until no removal is pending
+        bool propagateSupport(){
+            while (!mPending.empty() && !mError) {
+                if(mParallel and mPending.size() >= mParallelThreshold){
+                    if(propagateBands()){
+                        break;
+                    }
+                    // The bands may run into another contradiction than the serial order. Undo the propagation
+                    // and repeat it on one thread, so backjumping starts from the same conflict
+                    undoRemovals(mPropagationTrailStart);
+                    mPending.swap(mPendingStart);
+                    mParallel = false;
+                    continue;
+                }
+
+                if(mWork == 0){
+                    return false;
+                }
+                mWork--;
+
+                if constexpr (instrumented){
+                    mStats.maxQueueDepth = std::max(mStats.maxQueueDepth, mPending.size());
+                }
+                auto [cell, tile] = mPending.back();
+                mPending.pop_back();
+
+                if(grid.hasTile(cell, tile)){
+                    removeTile(cell, tile);
+                }
+            }
+            mPending.clear();
+            return true;
+        }
+
+        size_t bandOf(size_t i) const {
+            // Rows of all layers one after another
+            return (i / grid.mX) * mBands->size() / (grid.size() / grid.mX);
+        }
+
+        // Hand the pending removals to their bands and propagate them in parallel. Returns false on a contradiction
+        bool propagateBands(){
+            BandPropagation& bands = *mBands;
+            bands.conflict = false;
+            for (auto [cell, tile] : mPending) {
+                bands.bands[bandOf(cell)].pending.push_back({cell, tile});
+            }
+            mPending.clear();
+
+            bands.run();
+
+            // The removals of a band only depend on the messages it got, not on the timing of the threads
+            for (BandPropagation::Band& band : bands.bands) {
+                for (auto [cell, tile] : band.removals) {
+                    tracker.saveRemoval(cell, tile);
+                    mStats.removedTiles++;
+                }
+                mDirtyCells.insert(mDirtyCells.end(), band.dirtyCells.begin(), band.dirtyCells.end());
+                for (uint32_t cell : band.dirtyCells) {
+                    markChanged(cell);
+                }
+                band.removals.clear();
+                band.dirtyCells.clear();
+                band.pending.clear();
+            }
+            return !bands.conflict;
+        }
+
+        // Work of one band. A round removes the pending tiles of the band, then every band collects
+        // the messages sent to it. Ends when a round sent no message or a cell ran out of tiles
+        void propagateBand(size_t b){
+            BandPropagation& bands = *mBands;
+            BandPropagation::Band& band = bands.bands[b];
+
+            auto receive = [&]{
+                for (const BandPropagation::Message& message : band.inbox) {
+                    decrementSupport(getNeighbor(message.cell, message.direction), message.tile, message.direction, band.pending);
+                }
+                band.inbox.clear();
+            };
+
+            while (true) {
+                receive();
+                while (!band.pending.empty() and !bands.conflict.load(std::memory_order_relaxed)) {
+                    auto [cell, tile] = band.pending.back();
+                    band.pending.pop_back();
+
+                    if(grid.hasTile(cell, tile)){
+                        removeBandTile(b, cell, tile);
+                    }
+                }
+                bands.barrier.arrive_and_wait();
+
+                // Nobody removes tiles between the barriers, so every band sees the same conflict flag
+                bool conflict = bands.conflict;
+                for (BandPropagation::Band& other : bands.bands) {
+                    band.inbox.insert(band.inbox.end(), other.outbox[b].begin(), other.outbox[b].end());
+                    other.outbox[b].clear();
+                }
+                band.received = band.inbox.size();
+                bands.barrier.arrive_and_wait();
+
+                size_t received = 0;
+                for (const BandPropagation::Band& other : bands.bands) {
+                    received += other.received;
+                }
+                if(received == 0 or conflict){
+                    break;
+                }
+            }
+
+            // Sent removals still count, the support has to match the trail for undoing it
+            receive();
+        }
+
+        // removeTile for a cell owned by band b. Support in other bands is sent as a message
+        void removeBandTile(size_t b, size_t i, size_t tile){
+            BandPropagation::Band& band = mBands->bands[b];
+            if(!grid.removeTile(i, tile)){
+                return;
+            }
+            band.removals.push_back({static_cast<uint32_t>(i), static_cast<uint32_t>(tile)});
+
+            mSumWeight[i] -= mRules->fixedWeights[tile];
+            mSumWeightLogWeight[i] -= mRules->weightLogWeight[tile];
+            if(!mDirty[i]){
+                mDirty[i] = true;
+                band.dirtyCells.push_back(i);
+            }
+
+            for (size_t d=0; d < grid.directionCount(); d++) {
+                size_t n = getNeighbor(i, d);
+                if(n == Grid::invalid) continue;
+
+                size_t owner = bandOf(n);
+                if(owner == b){
+                    decrementSupport(n, tile, d, band.pending);
+                } else {
+                    band.outbox[owner].push_back({static_cast<uint32_t>(i), static_cast<uint32_t>(tile), static_cast<uint32_t>(d)});
+                }
+            }
+
+            if(grid.getEntropy(i) == 0){
+                mBands->conflict = true;
+            }
+        }
+
+        // Returns true if the tile has no support left from a neighbor on any side but skip
+        bool lacksSupport(size_t i, size_t tile, size_t skip){
+            for (size_t d=0; d < grid.directionCount(); d++) {
+                if(d != skip and getNeighbor(i, grid.opposite(d)) != Grid::invalid
+                   and mSupport[(i * grid.directionCount() + d) * grid.mTileCount + tile] == 0){
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // Take the support of a removed tile away from the neighbor n in direction d
+        void decrementSupport(size_t n, size_t tile, size_t d, std::vector<std::pair<uint32_t, uint32_t>>& pending){
+            uint16_t* support = &mSupport[(n * grid.directionCount() + d) * grid.mTileCount];
+            for (const uint32_t* c=mRules->compatibleBegin(tile, d); c != mRules->compatibleEnd(tile, d); c++) {
+                uint32_t u = *c;
+                // Support that already ran out on another side has queued the tile, so it's pending at most once
+                if(--support[u] == 0 && grid.hasTile(n, u) && !lacksSupport(n, u, d)){
+                    pending.push_back({static_cast<uint32_t>(n), u});
+                }
+            }
+        }
+
+        // Use a queue to keep track of cells whose possibilities have been reduced.
+        // It starts with the cell that just collapsed.
+        bool propagateBitset(){
+            while (mQueueSize > 0) {
+                if(mWork == 0){
+                    return false;
+                }
+                mWork--;
+
+                if constexpr (instrumented){
+                    mStats.maxQueueDepth = std::max(mStats.maxQueueDepth, mQueueSize);
+                }
+                size_t currentCell = dequeue();
+
+                // Every uncollapsed neighbor (up, right, down, left)
+                for (size_t d=0; d < grid.directionCount(); d++) {
+                    size_t neighborCell = getNeighbor(currentCell, d);
+                    if(neighborCell == Grid::invalid or grid.isCollapsed(neighborCell)) continue;
+
+                    // Get the mask of tiles in the neighbor that are still possible
+                    getValidTilesInDirection(currentCell, d, mValidTiles.data());
+
+                    // If the state of the neighbor will be changed
+                    if(getIntersectingTiles(neighborCell, mValidTiles.data())) {
+                        // If the cell has 0 possibilities, we have a contradiction!
+                        if(mError){
+                            return true;
+                        }
+
+                        // Add this neighbor to the queue
+                        enqueue(neighborCell);
+                    }
+                }
+            }
+            return true;
+        }
+
+        // Remove a tile from a cell, save it in the tracker and update the support of the neighbors
+        void removeTile(size_t i, size_t tile){
+            if(!grid.removeTile(i, tile)){
+                return;
+            }
+            tracker.saveRemoval(i, tile);
+            mStats.removedTiles++;
+
+            mSumWeight[i] -= mRules->fixedWeights[tile];
+            mSumWeightLogWeight[i] -= mRules->weightLogWeight[tile];
+            markDirty(i);
+
+            if(mUseSupport){
+                for (size_t d=0; d < grid.directionCount(); d++) {
+                    size_t n = getNeighbor(i, d);
+                    if(n != Grid::invalid) decrementSupport(n, tile, d, mPending);
+                }
+            }
+
+            // If the cell has 0 possibilities, we have a contradiction!
+            if(grid.getEntropy(i) == 0 and !mError){
+                mError = true;
+                mConflictCell = i;
+            }
+        }
+
+        // Restore every tile removed after trailStart
+        void undoRemovals(size_t trailStart){
+            while (tracker.trail.size() > trailStart) {
+                BackTracker::Removal removal = tracker.popRemoval();
+                restoreTile(removal.cell, removal.getTile());
+            }
+        }
+
+        // Inverse of removeTile
+        void restoreTile(size_t i, size_t tile){
+            grid.addTile(i, tile);
+
+            mSumWeight[i] += mRules->fixedWeights[tile];
+            mSumWeightLogWeight[i] += mRules->weightLogWeight[tile];
+            markDirty(i);
+
+            if(mUseSupport){
+                for (size_t d=0; d < grid.directionCount(); d++) {
+                    size_t n = getNeighbor(i, d);
+                    if(n == Grid::invalid) continue;
+
+                    uint16_t* support = &mSupport[(n * grid.directionCount() + d) * grid.mTileCount];
+                    for (const uint32_t* c=mRules->compatibleBegin(tile, d); c != mRules->compatibleEnd(tile, d); c++) {
+                        support[*c]++;
+                    }
+                }
+            }
+        }
+
+        // Set the weight sums of the full wave
+        void initializeEntropy(){
+            mSumWeight.assign(grid.size(), mRules->sumWeight);
+            mSumWeightLogWeight.assign(grid.size(), mRules->sumWeightLogWeight);
+            mDirty.assign(grid.size(), false);
+            mDirtyCells.clear();
+        }
+
+        // Shannon entropy of the weights of a cell plus its noise
+        double getEntropy(size_t i){
+            return weightEntropy(i) + mNoise[i];
+        }
+
+        double weightEntropy(size_t i){
+            double entropy = 0;
+            if(grid.getEntropy(i) > 1 and mSumWeight[i] > 0){
+                // Both sums carry the fixed point scale, it cancels in the quotient
+                double sumWeight = mSumWeight[i];
+                entropy = std::log(sumWeight / CompiledTileSet::fixedScale) - mSumWeightLogWeight[i] / sumWeight;
+            }
+            return entropy;
+        }
+
+        void markDirty(size_t i){
+            if(!mDirty[i]){
+                mDirty[i] = true;
+                mDirtyCells.push_back(i);
+            }
+            markChanged(i);
+        }
+
+        void markChanged(size_t i){
+            if(mTrackChanges and !mChanged[i]){
+                mChanged[i] = true;
+                mChangedCells.push_back(i);
+            }
+        }
+
+        // Every cell counts as changed, the list starts over
+        void resetChanges(){
+            mAllChanged = true;
+            mChangedCells.clear();
+            if(mTrackChanges){
+                mChanged.assign(grid.size(), false);
+                mChangedCells.reserve(grid.size());
+            } else {
+                mChanged.clear();
+            }
+        }
+
+        // Move every changed cell to its new place in the heap
+        void updateEntropies(){
+            for (uint32_t i : mDirtyCells) {
+                mDirty[i] = false;
+                if(mHeap.contains(i)){
+                    mHeap.update(i, getEntropy(i));
+                }
+            }
+            mDirtyCells.clear();
+        }
+
+        // Make the full wave arc consistent. Tiles nothing allows next to them are removed from every cell with a
+        // neighbor on that side, e.g. tiles that need a neighbor across the border, and the removals are propagated
+        void presolve(){
+            size_t tileCount = grid.mTileCount;
+            startPropagation(Grid::invalid);
+            if(mUseSupport){
+                initializeSupport();
+            } else {
+                // Every cell is full, so the tiles a neighbor allows are the union over all tiles
+                std::vector<uint64_t> full(grid.words(), 0), allowed(grid.directionCount() * grid.words());
+                for (size_t tile=0; tile < tileCount; tile++) full[tile / 64] |= uint64_t(1) << (tile % 64);
+                for (size_t d=0; d < grid.directionCount(); d++) {
+                    simd::kernels().unionOfMasks(&allowed[d * grid.words()], full.data(), mRules->adjacencyMask(0, d), grid.words());
+                }
+                for (size_t i=0; i < grid.size() and !mError; i++) {
+                    bool changed = false;
+                    for (size_t d=0; d < grid.directionCount() and !mError; d++) {
+                        if(getNeighbor(i, grid.opposite(d)) != Grid::invalid){
+                            changed |= getIntersectingTiles(i, &allowed[d * grid.words()]);
+                        }
+                    }
+                    if(changed) enqueue(i);
+                }
+            }
+            if(!mError){
+                mUseSupport ? propagateSupport() : propagateBitset();
+            }
+            mPropagating = false;
+        }
+
+        // Set the support of the full wave and remove tiles that can never be supported
+        void initializeSupport(){
+            size_t tileCount = grid.mTileCount;
+            std::span<const uint32_t> initialSupport = mRules->initialSupport;
+
+            mSupport.resize(grid.size() * initialSupport.size());
+            for (size_t i=0; i < grid.size(); i++) {
+                std::copy(initialSupport.begin(), initialSupport.end(), &mSupport[i * initialSupport.size()]);
+            }
+
+            // A tile nothing allows next to it can't be placed in a cell that has a neighbor on that side
+            for (size_t d=0; d < grid.directionCount(); d++) {
+                for (size_t u=0; u < tileCount; u++) {
+                    if(initialSupport[d * tileCount + u] != 0) continue;
+
+                    for (size_t i=0; i < grid.size(); i++) {
+                        if(getNeighbor(i, grid.opposite(d)) != Grid::invalid){
+                            removeTile(i, u);
+                        }
+                    }
+                }
+            }
+        }
+
+        // Returns true if the presolve cache has the wave and it was copied into the solver
+        bool loadInitialWave(){
+            std::shared_ptr<const PresolveCache::Wave> initial = mPresolveCache ? mPresolveCache->find(*mRules, grid.mTopology, mUseSupport) : nullptr;
+            if(!initial){
+                return false;
+            }
+            grid.mWave = initial->wave;
+            grid.mCount = initial->count;
+            grid.mCollapsed = initial->collapsed;
+            mSumWeight = initial->sumWeight;
+            mSumWeightLogWeight = initial->sumWeightLogWeight;
+            mError = initial->error;
+            if(mUseSupport){
+                recomputeSupport();
+            }
+            return true;
+        }
+
+        void saveInitialWave(){
+            if(!mPresolveCache){
+                return;
+            }
+            auto initial = std::make_shared<PresolveCache::Wave>();
+            initial->wave = grid.mWave;
+            initial->count = grid.mCount;
+            initial->collapsed = grid.mCollapsed;
+            initial->sumWeight = mSumWeight;
+            initial->sumWeightLogWeight = mSumWeightLogWeight;
+            initial->error = mError;
+            mPresolveCache->insert(*mRules, grid.mTopology, mUseSupport, std::move(initial));
+        }
+
+        // Put every cell of the rectangle [x0, x1) x [y0, y1) back into superposition and remove the tiles the cells
+        // around it don't allow. The wave at that point is the new level 0. Returns false on a contradiction
+        bool resetRegion(size_t x0, size_t y0, size_t x1, size_t y1){
+            auto inRegion = [&](size_t i){
+                size_t x = i % grid.mX, y = (i / grid.mX) % grid.mY;
+                return x >= x0 and x < x1 and y >= y0 and y < y1;
+            };
+            auto forEachCell = [&](auto&& f){
+                for (size_t z=0; z < grid.mZ; z++) {
+                    for (size_t y=y0; y < y1; y++) {
+                        for (size_t x=x0; x < x1; x++) {
+                            f(grid.index(x, y, z));
+                        }
+                    }
+                }
+            };
+
+            tracker.rebase();
+            mFloor = 0;
+            mPending.clear();
+            mPropagating = false;
+            mCollapsed = false;
+            mError = false;
+
+            size_t lastWord = grid.words() - 1;
+            uint64_t lastMask = grid.mTileCount % 64 ? (uint64_t(1) << (grid.mTileCount % 64)) - 1 : ~uint64_t(0);
+            forEachCell([&](size_t i){
+                for (size_t w=0; w < grid.words(); w++) {
+                    uint64_t missing = ~grid.cell(i)[w] & (w == lastWord ? lastMask : ~uint64_t(0));
+                    for (; missing; missing &= missing - 1) {
+                        restoreTile(i, w * 64 + std::countr_zero(missing));
+                    }
+                }
+                grid.mCollapsed[i] = false;
+                markChanged(i);
+                if(!mHeap.contains(i)) mHeap.push(i, getEntropy(i));
+            });
+
+            startPropagation(Grid::invalid);
+            if(mUseSupport){
+                // A tile without support from a neighbor on some side can't stay
+                forEachCell([&](size_t i){
+                    grid.forEachTile(i, [&](size_t tile){
+                        if(lacksSupport(i, tile, grid.directionCount())) mPending.push_back({static_cast<uint32_t>(i), static_cast<uint32_t>(tile)});
+                    });
+                });
+            } else {
+                // Intersect the border of the region with the cells around it and propagate from there
+                forEachCell([&](size_t i){
+                    for (size_t d=0; d < grid.directionCount() and !mError; d++) {
+                        size_t n = getNeighbor(i, d);
+                        if(n == Grid::invalid or inRegion(n)) continue;
+
+                        getValidTilesInDirection(n, grid.opposite(d), mValidTiles.data());
+                        if(getIntersectingTiles(i, mValidTiles.data())){
+                            enqueue(i);
+                        }
+                    }
+                });
+            }
+            continuePropagation();
+            return !mError;
+        }
+
+        static constexpr char snapshotMagic[8] = {'L', 'W', 'F', 'C', 'S', 'N', 'A', 'P'};
+        static constexpr uint64_t snapshotVersion = 3;
+        std::vector<uint8_t> mSnapshotBuffer;
+
+        template<typename T>
+        static void writeList(ByteWriter& writer, const std::vector<T>& list){
+            writer.varint(list.size());
+            for (T value : list) {
+                writer.varint(value);
+            }
+        }
+
+        static void writePairs(ByteWriter& writer, const std::vector<std::pair<uint32_t, uint32_t>>& list){
+            writer.varint(list.size());
+            for (auto [cell, tile] : list) {
+                writer.varint(cell);
+                writer.varint(tile);
+            }
+        }
+
+        // Field by field, so the snapshot doesn't depend on the padding of the structs
+        static void writeStrategy(ByteWriter& writer, const SearchStrategy& strategy){
+            writer.varint(static_cast<uint64_t>(strategy.tieBreak));
+            writer.varint(strategy.backjumping);
+            writer.varint(static_cast<uint64_t>(strategy.restart));
+            writer.varint(strategy.restartBase);
+            writer.value(strategy.restartFactor);
+        }
+
+        // Returns false on an unknown tie break or restart
+        static bool readStrategy(ByteReader& reader, SearchStrategy& strategy){
+            uint64_t tieBreak = reader.varint();
+            strategy.backjumping = reader.varint();
+            uint64_t restart = reader.varint();
+            strategy.restartBase = reader.varint();
+            strategy.restartFactor = reader.value<double>();
+            if(tieBreak > static_cast<uint64_t>(SearchStrategy::TieBreak::Scan) or restart > static_cast<uint64_t>(SearchStrategy::Restart::Geometric)){
+                return false;
+            }
+            strategy.tieBreak = static_cast<SearchStrategy::TieBreak>(tieBreak);
+            strategy.restart = static_cast<SearchStrategy::Restart>(restart);
+            return reader.ok;
+        }
+
+        static void writeStats(ByteWriter& writer, const SearchStats& stats){
+            for (size_t count : {stats.decisions, stats.contradictions, stats.backtracks, stats.skippedLevels, stats.restarts, stats.removedTiles,
+                                 stats.propagations, stats.cellsTouched, stats.maxCellsTouched, stats.maxQueueDepth}) {
+                writer.varint(count);
+            }
+            for (double seconds : {stats.seconds, stats.timeToSolution, stats.observeSeconds, stats.collapseSeconds, stats.propagateSeconds}) {
+                writer.value(seconds);
+            }
+        }
+
+        static void readStats(ByteReader& reader, SearchStats& stats){
+            for (size_t* count : {&stats.decisions, &stats.contradictions, &stats.backtracks, &stats.skippedLevels, &stats.restarts, &stats.removedTiles,
+                                  &stats.propagations, &stats.cellsTouched, &stats.maxCellsTouched, &stats.maxQueueDepth}) {
+                *count = reader.varint();
+            }
+            for (double* seconds : {&stats.seconds, &stats.timeToSolution, &stats.observeSeconds, &stats.collapseSeconds, &stats.propagateSeconds}) {
+                *seconds = reader.value<double>();
+            }
+        }
+
+        // Returns false if an entry isn't below limit
+        template<typename T>
+        static bool readList(ByteReader& reader, std::vector<T>& list, size_t limit){
+            list.resize(std::min<uint64_t>(reader.varint(), reader.data.size()));
+            for (T& value : list) {
+                uint64_t read = reader.varint();
+                if(read >= limit) return false;
+                value = static_cast<T>(read);
+            }
+            return reader.ok;
+        }
+
+        bool readPairs(ByteReader& reader, std::vector<std::pair<uint32_t, uint32_t>>& list) const {
+            list.resize(std::min<uint64_t>(reader.varint(), reader.data.size()));
+            for (auto& [cell, tile] : list) {
+                cell = reader.varint();
+                tile = reader.varint();
+                if(cell >= grid.size() or tile >= grid.mTileCount) return false;
+            }
+            return reader.ok;
+        }
+
+        // Buffers bounded by the cells or tiles are reserved up front
+        void reserveScratch(){
+            if constexpr (Words == 0){
+                mValidTiles.resize(grid.words());
+            }
+            mQueue.resize(grid.size());
+            mInQueue.assign(grid.size(), 0);
+            mQueueHead = 0;
+            mQueueSize = 0;
+            mDirtyCells.reserve(grid.size());
+            mConflictLevels.reserve(grid.size());
+            mConflictLevelSeen.assign(grid.size() + 1, 0);
+            tracker.decisions.reserve(grid.size());
+            // A removed tile has to be restored before it can be removed again, so the trail never holds more than
+            // every tile of every cell. Pages of the reservation are only touched once the trail grows into them,
+            // huge grids of huge tilesets reserve less than that and may still grow the trail while solving
+            tracker.trail.reserve(std::min<size_t>(grid.size() * grid.mTileCount, maxTrailReserve));
+            // Every tile is pending at most once, the same bound as the trail
+            mPending.reserve(std::min<size_t>(grid.size() * grid.mTileCount, maxTrailReserve));
+            // Bans rarely outnumber the cells
+            tracker.banTrailIndex.reserve(grid.size());
+            tracker.banReasonStart.reserve(grid.size());
+            tracker.banReasons.reserve(grid.size());
+        }
+
+        // Count the support of every tile from the current wave. Walks the tiles of the neighbor that are left
+        // or the ones that are gone, whichever are fewer
+        void recomputeSupport(){
+            size_t tileCount = grid.mTileCount;
+            size_t directions = grid.directionCount();
+            std::span<const uint32_t> initialSupport = mRules->initialSupport;
+            mSupport.resize(grid.size() * directions * tileCount);
+
+            for (size_t i=0; i < grid.size(); i++) {
+                for (size_t d=0; d < directions; d++) {
+                    uint16_t* support = &mSupport[(i * directions + d) * tileCount];
+                    std::copy(&initialSupport[d * tileCount], &initialSupport[d * tileCount] + tileCount, support);
+
+                    size_t n = getNeighbor(i, grid.opposite(d));
+                    if(n == Grid::invalid) continue;
+
+                    if(grid.getEntropy(n) * 2 <= tileCount){
+                        std::fill(support, support + tileCount, 0);
+                        grid.forEachTile(n, [&](size_t tile){
+                            for (const uint32_t* c=mRules->compatibleBegin(tile, d); c != mRules->compatibleEnd(tile, d); c++) support[*c]++;
+                        });
+                    } else if(grid.getEntropy(n) != tileCount){
+                        for (size_t w=0; w < grid.words(); w++) {
+                            uint64_t missing = ~grid.cell(n)[w];
+                            if(w == grid.words() - 1 and tileCount % 64) missing &= (uint64_t(1) << (tileCount % 64)) - 1;
+                            for (; missing; missing &= missing - 1) {
+                                size_t tile = w * 64 + std::countr_zero(missing);
+                                for (const uint32_t* c=mRules->compatibleBegin(tile, d); c != mRules->compatibleEnd(tile, d); c++) support[*c]--;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        // Draw new tie breaking noise and put every uncollapsed cell in the heap
+        void buildHeap(){
+            // Scan order: bit 0 flips x, bit 1 flips y, bit 2 scans columns first
+            size_t orientation = mStrategy.tieBreak == SearchStrategy::TieBreak::Scan ? generateRandomInt(0, 7) : 0;
+
+            mNoise.resize(grid.size());
+            mHeap.reset(grid.size());
+            // Most cells still have the same weights, the logarithm is only taken when they change
+            size_t lastCell = Grid::invalid;
+            double lastEntropy = 0;
+            size_t rows = grid.mX ? grid.size() / grid.mX : 0; // The rows of all layers one after another
+            for (size_t i=0; i < grid.size(); i++) {
+                if(mStrategy.tieBreak == SearchStrategy::TieBreak::Scan){
+                    size_t x = i % grid.mX, y = i / grid.mX;
+                    if(orientation & 1) x = grid.mX - 1 - x;
+                    if(orientation & 2) y = rows - 1 - y;
+                    size_t rank = orientation & 4 ? x * rows + y : y * grid.mX + x;
+                    mNoise[i] = 1e-6 * rank / grid.size();
+                } else {
+                    mNoise[i] = mRandom.uniform() * 1e-6;
+                }
+
+                if(!grid.isCollapsed(i)){
+                    if(lastCell == Grid::invalid or grid.getEntropy(i) != grid.getEntropy(lastCell) or mSumWeight[i] != mSumWeight[lastCell]
+                       or mSumWeightLogWeight[i] != mSumWeightLogWeight[lastCell]){
+                        lastCell = i;
+                        lastEntropy = weightEntropy(i);
+                    }
+                    mHeap.append(i, lastEntropy + mNoise[i]);
+                }
+            }
+            mHeap.heapify();
+        }
+
+        //---------------- Helpers ----------------
+        // Luby sequence 1, 1, 2, 1, 1, 2, 4, ... starting at n = 1
+        static size_t luby(size_t n){
+            while (true) {
+                // Find the smallest k with 2^k - 1 >= n
+                size_t k = 1;
+                while ((size_t(1) << k) - 1 < n) k++;
+
+                if(n == (size_t(1) << k) - 1) return size_t(1) << (k - 1);
+                n -= (size_t(1) << (k - 1)) - 1;
+            }
+        }
+
+        // Generate a random int from start to end
+        size_t generateRandomInt(size_t start, size_t end) {
+            return start + mRandom.below(end - start + 1);
+        }
+
+        // Returns the index of the neighbor in a direction or Grid::invalid at the border
+        size_t getNeighbor(size_t i, size_t d){
+            return grid.neighbor(i, d);
+        }
+
+        // Get all valid tiles from a cell in the specified directions as mask
+        void getValidTilesInDirection(size_t i, size_t direction, uint64_t* validTiles){
+            // Add all rules from every possibleTile from the cell in the direction together
+            const uint64_t* masks = mRules->adjacencyMask(0, direction);
+            if constexpr (Words != 0 and Words <= maxFixedWords){
+                // Few enough words to keep the union in registers, the vector kernels only pay off for wide domains
+                std::array<uint64_t, Words> valid{};
+                const uint64_t* domain = grid.cell(i);
+                for (size_t w=0; w < Words; w++) {
+                    for (uint64_t bits=domain[w]; bits; bits &= bits - 1) {
+                        const uint64_t* mask = masks + (w * 64 + std::countr_zero(bits)) * Words;
+                        for (size_t v=0; v < Words; v++) {
+                            valid[v] |= mask[v];
+                        }
+                    }
+                }
+                std::copy(valid.begin(), valid.end(), validTiles);
+            } else {
+                simd::kernels().unionOfMasks(validTiles, grid.cell(i), masks, grid.words());
+            }
+        }
+
+        // Remove every tile of a cell that is not in the mask. Returns true if the cell changed
+        bool getIntersectingTiles(size_t i, const uint64_t* validTiles){
+            // Most neighbors keep all their tiles, one vector pass finds that out
+            if constexpr (Words != 0 and Words <= maxFixedWords){
+                uint64_t removed = 0;
+                for (size_t w=0; w < Words; w++) {
+                    removed |= grid.cell(i)[w] & ~validTiles[w];
+                }
+                if(removed == 0){
+                    return false;
+                }
+            } else if(simd::kernels().countRemoved(grid.cell(i), validTiles, grid.words()) == 0){
+                return false;
+            }
+
+            bool changed = false;
+            for (size_t w=0; w < grid.words(); w++) {
+                uint64_t removed = grid.cell(i)[w] & ~validTiles[w];
+                while (removed) {
+                    removeTile(i, w * 64 + std::countr_zero(removed));
+                    removed &= removed - 1;
+                    changed = true;
+                }
+            }
+            return changed;
+        }
+    };
+
+    using WFC = BasicWFC<>;
+
+    // Calls f(std::integral_constant<size_t, Words>) with the words per cell of the fastest solver for a tileset,
+    // BasicWFC<decltype(words)::value> inside f is that solver. Tilesets above maxFixedWords * 64 tiles get 0
+    template<typename F>
+    decltype(auto) withSolverWords(const CompiledTileSet& tileset, F&& f){
+        switch (tileset.words) {
+            case 1: return f(std::integral_constant<size_t, 1>());
+            case 2: return f(std::integral_constant<size_t, 2>());
+            case 3: return f(std::integral_constant<size_t, 3>());
+            case 4: return f(std::integral_constant<size_t, 4>());
+            default: return f(std::integral_constant<size_t, 0>());
+        }
+    }
 }
\ No newline at end of file
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <lufuWFC.hpp>
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace lufuWFC{
+
+    struct BatchResult{
+        uint64_t seed = 0;
+        bool solved = false;
+        TileMap map;
+        SearchStats stats;
+    };
+
+    struct BatchSettings{
+        enum class Mode{
+            All,    // Solve every seed
+            FirstK, // Stop once k maps are solved
+            Race    // Stop at the first solved map
+        };
+
+        size_t width = 64, height = 64;
+        int backtrack = 1000;
+        size_t threads = std::thread::hardware_concurrency();
+        Mode mode = Mode::All;
+        size_t k = 1;
+        SearchStrategy strategy;
+        Propagator propagator = Propagator::Bitset;
+    };
+
+    // Solves many seeds of one tileset in parallel. All workers share the same compiled tileset and every
+    // worker reuses its solver, so a map only pays for initialize and solve
+    class BatchSolver{
+    public:
+        BatchSettings settings;
+
+        BatchSolver(std::shared_ptr<const CompiledTileSet> tileset, const BatchSettings& batchSettings): settings(batchSettings), mTileset(std::move(tileset)){}
+
+        // Solve the seeds [firstSeed, lastSeed). onResult is called for every finished map as soon as it is done,
+        // one call at a time but from the worker threads. Maps cancelled by FirstK or Race are not reported.
+        // Returns the number of solved maps
+        size_t run(uint64_t firstSeed, uint64_t lastSeed, const std::function<void(const BatchResult&)>& onResult){
+            std::atomic<uint64_t> next{firstSeed};
+            std::atomic<bool> stop{false};
+            std::mutex resultMutex;
+            size_t solvedCount = 0;
+            size_t target = settings.mode == BatchSettings::Mode::All ? SIZE_MAX : settings.mode == BatchSettings::Mode::Race ? 1 : settings.k;
+
+            // Every worker uses the solver specialized for the size of the tileset
+            auto work = [&]{
+                withSolverWords(*mTileset, [&](auto words){
+                    BasicWFC<decltype(words)::value> wfc;
+                    wfc.setCancelFlag(&stop);
+                    wfc.setSearchStrategy(settings.strategy);
+                    wfc.setPresolveCache(mPresolveCache);
+                    wfc.setPropagator(settings.propagator);
+
+                    BatchResult result;
+                    while (!stop) {
+                        uint64_t seed = next++;
+                        if(seed >= lastSeed){
+                            break;
+                        }
+
+                        wfc.initialize(settings.width, settings.height, seed, mTileset);
+                        result.seed = seed;
+                        result.solved = wfc.solve(-1, settings.backtrack);
+                        if(stop){
+                            break;
+                        }
+                        result.stats = wfc.getSearchStats();
+                        wfc.getTiles(result.map);
+
+                        std::lock_guard<std::mutex> lock(resultMutex);
+                        if(stop){
+                            break;
+                        }
+                        if(result.solved and ++solvedCount >= target){
+                            stop = true;
+                        }
+                        onResult(result);
+                    }
+                });
+            };
+
+            std::vector<std::thread> threads;
+            for (size_t i=1; i < std::max<size_t>(settings.threads, 1); i++) {
+                threads.emplace_back(work);
+            }
+            work();
+            for (auto& thread : threads) {
+                thread.join();
+            }
+
+            return solvedCount;
+        }
+
+    private:
+        std::shared_ptr<const CompiledTileSet> mTileset;
+        std::shared_ptr<PresolveCache> mPresolveCache = std::make_shared<PresolveCache>(); // Shared by the workers
+    };
+}
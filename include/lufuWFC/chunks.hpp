@@ -0,0 +1,345 @@
+#pragma once
+
+#include <lufuWFC.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace lufuWFC{
+
+    // Thread pool where every worker owns a deque. Workers take their own newest task first and
+    // steal the oldest task of another worker when they run dry
+    class WorkStealingPool{
+    public:
+        explicit WorkStealingPool(size_t threads = std::thread::hardware_concurrency()){
+            threads = std::max<size_t>(threads, 1);
+            for (size_t i=0; i < threads; i++) {
+                mQueues.push_back(std::make_unique<Queue>());
+            }
+            for (size_t i=0; i < threads; i++) {
+                mThreads.emplace_back([this, i]{ run(i); });
+            }
+        }
+
+        ~WorkStealingPool(){
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                mStop = true;
+            }
+            mWake.notify_all();
+            for (auto& thread : mThreads) {
+                thread.join();
+            }
+        }
+
+        size_t size() const { return mThreads.size(); }
+
+        // Index of the calling worker, or size() if called from outside the pool
+        size_t currentWorker() const {
+            return tPool == this ? tWorker : size();
+        }
+
+        // Tasks submitted by a worker go to its own deque, other tasks are spread round robin
+        void submit(std::function<void()> task){
+            size_t worker = currentWorker();
+            if(worker == size()){
+                worker = mNext++ % size();
+            }
+
+            mPending++;
+            {
+                std::lock_guard<std::mutex> lock(mQueues[worker]->mutex);
+                mQueues[worker]->tasks.push_back(std::move(task));
+            }
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                mQueued++;
+            }
+            mWake.notify_one();
+        }
+
+        // Block until every submitted task, including the ones they submitted, has finished
+        void wait(){
+            std::unique_lock<std::mutex> lock(mMutex);
+            mIdle.wait(lock, [this]{ return mPending == 0; });
+        }
+
+    private:
+        struct Queue{
+            std::mutex mutex;
+            std::deque<std::function<void()>> tasks;
+        };
+
+        std::vector<std::unique_ptr<Queue>> mQueues;
+        std::vector<std::thread> mThreads;
+
+        std::mutex mMutex;
+        std::condition_variable mWake;
+        std::condition_variable mIdle;
+        std::atomic<size_t> mQueued{0};  // Tasks waiting in a deque
+        std::atomic<size_t> mPending{0}; // Tasks not finished yet
+        std::atomic<size_t> mNext{0};
+        bool mStop = false;
+
+        static inline thread_local const WorkStealingPool* tPool = nullptr;
+        static inline thread_local size_t tWorker = 0;
+
+        bool tryPop(size_t self, std::function<void()>& task){
+            // Own deque first, newest task
+            {
+                std::lock_guard<std::mutex> lock(mQueues[self]->mutex);
+                if(!mQueues[self]->tasks.empty()){
+                    task = std::move(mQueues[self]->tasks.back());
+                    mQueues[self]->tasks.pop_back();
+                    mQueued--;
+                    return true;
+                }
+            }
+
+            // Steal the oldest task of another worker
+            for (size_t n=1; n < mQueues.size(); n++) {
+                Queue& victim = *mQueues[(self + n) % mQueues.size()];
+                std::lock_guard<std::mutex> lock(victim.mutex);
+                if(!victim.tasks.empty()){
+                    task = std::move(victim.tasks.front());
+                    victim.tasks.pop_front();
+                    mQueued--;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void run(size_t self){
+            tPool = this;
+            tWorker = self;
+
+            std::function<void()> task;
+            while (true) {
+                if(tryPop(self, task)){
+                    task();
+                    task = nullptr;
+
+                    if(--mPending == 0){
+                        std::lock_guard<std::mutex> lock(mMutex);
+                        mIdle.notify_all();
+                    }
+                    continue;
+                }
+
+                std::unique_lock<std::mutex> lock(mMutex);
+                mWake.wait(lock, [this]{ return mStop or mQueued > 0; });
+                if(mStop and mQueued == 0){
+                    return;
+                }
+            }
+        }
+    };
+
+    struct ChunkSettings{
+        size_t chunkSize = 64;
+        size_t threads = std::thread::hardware_concurrency();
+        size_t retries = 4;       // Extra seeds tried per chunk before it is left for the repair pass
+        int backtrack = 1000;     // Backtrack budget of every solve
+        size_t overlap = 8;       // Cells of the neighbors re-solved together with a failed chunk, within a phase at most half a chunk
+        size_t maxOverlap = 64;   // The overlap doubles up to this size while the repair keeps failing
+        SearchStrategy strategy;
+        Propagator propagator = Propagator::Bitset;
+    };
+
+    // Solves a large map in chunks on a thread pool. The chunks are colored like a 2x2 checkerboard and solved in
+    // four phases, chunks of one phase never touch, so every phase runs up to a quarter of the chunks at once.
+    // The border cells committed by earlier phases are set in the chunk like manualSetCell would, which closes the
+    // last phase in on every side. Tilesets that can't always close a region, like paths that have to leave it
+    // an even number of times, fail more of those chunks the smaller the chunks are. Failed chunks are re-solved
+    // afterwards on the pool together with a band of their neighbors (modifying in blocks).
+    // Every chunk gets its own seed, so the map only depends on the seed and not on the scheduling
+    class ChunkGenerator{
+    public:
+        ChunkSettings settings;
+
+        ChunkGenerator(){}
+        explicit ChunkGenerator(const ChunkSettings& chunkSettings): settings(chunkSettings){}
+
+        // Generate a width x height map. Returns false if some cells couldn't be solved, they stay -1
+        bool generate(size_t width, size_t height, uint64_t seed, TileSet& tileset, TileMap& map){
+            return generate(width, height, seed, std::make_shared<const CompiledTileSet>(tileset), map);
+        }
+
+        bool generate(size_t width, size_t height, uint64_t seed, std::shared_ptr<const CompiledTileSet> tileset, TileMap& map){
+            map.resize(width, height);
+            mSeed = seed;
+            mTileset = std::move(tileset);
+            mMap = &map;
+
+            mChunkSize = std::max<size_t>(settings.chunkSize, 1);
+            mChunksX = (width + mChunkSize - 1) / mChunkSize;
+            mChunksY = (height + mChunkSize - 1) / mChunkSize;
+            mFailed.assign(mChunksX * mChunksY, false);
+
+            // The chunks are solved with the solver specialized for the size of the tileset
+            return withSolverWords(*mTileset, [&](auto words){
+                using Solver = BasicWFC<decltype(words)::value>;
+
+                WorkStealingPool pool(settings.threads);
+                std::vector<Solver> solvers(pool.size()); // One per worker
+                for (Solver& solver : solvers) {
+                    solver.setPresolveCache(mPresolveCache);
+                }
+
+                // Phase p holds the chunks with cx % 2 == p % 2 and cy % 2 == p / 2
+                for (size_t phase=0; phase < 4; phase++) {
+                    for (size_t cy=phase / 2; cy < mChunksY; cy += 2) {
+                        for (size_t cx=phase % 2; cx < mChunksX; cx += 2) {
+                            pool.submit([this, &pool, &solvers, cx, cy]{ solveChunk(solvers[pool.currentWorker()], cx, cy); });
+                        }
+                    }
+                    pool.wait();
+                }
+
+                // Repair pass, every neighbor is committed now. The repairs of one color are far enough apart
+                // that their regions, including the pinned border, never overlap
+                std::atomic<bool> solved{true};
+                size_t period = repairPeriod();
+                for (size_t color=0; color < period * period; color++) {
+                    for (size_t cy=color / period; cy < mChunksY; cy += period) {
+                        for (size_t cx=color % period; cx < mChunksX; cx += period) {
+                            if(!mFailed[cy * mChunksX + cx]){
+                                continue;
+                            }
+                            pool.submit([this, &pool, &solvers, &solved, cx, cy]{
+                                if(!repairChunk(solvers[pool.currentWorker()], cx, cy)){
+                                    solved = false;
+                                }
+                            });
+                        }
+                    }
+                    pool.wait();
+                }
+                return solved.load();
+            });
+        }
+
+    private:
+        uint64_t mSeed = 0;
+        std::shared_ptr<const CompiledTileSet> mTileset;
+        std::shared_ptr<PresolveCache> mPresolveCache = std::make_shared<PresolveCache>(); // One wave per region shape
+        TileMap* mMap = nullptr;
+        size_t mChunkSize = 1;
+        size_t mChunksX = 0, mChunksY = 0;
+        std::vector<uint8_t> mFailed;
+
+        template<typename Solver>
+        void solveChunk(Solver& wfc, size_t cx, size_t cy){
+            // Neighbors of the earlier phases are committed and pinned, the others are still empty
+            size_t attempt = 0;
+            bool solved = solveBand(wfc, cx, cy, 0, attempt);
+
+            // A chunk pinned on every side often has no solution, so it re-solves a band of its neighbors too.
+            // The band stays clear of the other chunks of the phase, they are a chunk apart
+            size_t band = std::min(settings.overlap, (mChunkSize - 1) / 2);
+            if(!solved and band > 0){
+                solved = solveBand(wfc, cx, cy, band, attempt);
+            }
+            mFailed[cy * mChunksX + cx] = !solved;
+        }
+
+        // Largest band a repair grows by
+        size_t maxRepairOverlap() const {
+            size_t overlap = settings.overlap;
+            while (overlap > 0 and overlap < settings.maxOverlap) {
+                overlap *= 2;
+            }
+            return overlap;
+        }
+
+        // Distance in chunks between two repairs that may run at the same time
+        size_t repairPeriod() const {
+            size_t reach = maxRepairOverlap() + 1; // The band and the pinned border around it
+            return 1 + (2 * reach + mChunkSize - 1) / mChunkSize;
+        }
+
+        // Re-solve a failed chunk with a growing band of its neighbors
+        template<typename Solver>
+        bool repairChunk(Solver& wfc, size_t cx, size_t cy){
+            size_t attempt = 2 * (settings.retries + 1); // Behind the seeds of solveChunk
+            for (size_t overlap=settings.overlap; ; overlap *= 2) {
+                if(solveBand(wfc, cx, cy, overlap, attempt)){
+                    return true;
+                }
+                if(overlap == 0 or overlap >= settings.maxOverlap){
+                    return false;
+                }
+            }
+        }
+
+        // Solve a chunk together with a band of its neighbors, trying one seed plus the retries
+        template<typename Solver>
+        bool solveBand(Solver& wfc, size_t cx, size_t cy, size_t overlap, size_t& attempt){
+            size_t x0 = cx * mChunkSize, y0 = cy * mChunkSize;
+            size_t x1 = std::min(x0 + mChunkSize, mMap->mX), y1 = std::min(y0 + mChunkSize, mMap->mY);
+            size_t rx0 = x0 > overlap ? x0 - overlap : 0, ry0 = y0 > overlap ? y0 - overlap : 0;
+            size_t rx1 = std::min(x1 + overlap, mMap->mX), ry1 = std::min(y1 + overlap, mMap->mY);
+
+            for (size_t n=0; n <= settings.retries; n++) {
+                // The region only replaces the map if it was solved, so a failed attempt doesn't lose anything
+                if(solveRegion(wfc, rx0, ry0, rx1, ry1, chunkSeed(cx, cy, attempt++))){
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // Solve the cells [x0, x1) x [y0, y1) with the surrounding committed cells as constraints.
+        // The region is written into the map only if it was solved
+        template<typename Solver>
+        bool solveRegion(Solver& wfc, size_t x0, size_t y0, size_t x1, size_t y1, uint64_t seed){
+            TileMap& map = *mMap;
+
+            // Grow the region by one cell on every side, cells that aren't committed yet stay open
+            size_t bx0 = x0 > 0 ? x0 - 1 : x0, by0 = y0 > 0 ? y0 - 1 : y0;
+            size_t bx1 = x1 < map.mX ? x1 + 1 : x1, by1 = y1 < map.mY ? y1 + 1 : y1;
+
+            wfc.setSearchStrategy(settings.strategy);
+            wfc.setPropagator(settings.propagator);
+            wfc.initialize(bx1 - bx0, by1 - by0, seed, mTileset);
+
+            // Set the border cells that are already committed
+            for (size_t y=by0; y < by1; y++) {
+                for (size_t x=bx0; x < bx1; x++) {
+                    bool inside = x >= x0 and x < x1 and y >= y0 and y < y1;
+                    if(!inside and map(x, y) >= 0){
+                        wfc.manualSetCell(x - bx0, y - by0, static_cast<size_t>(map(x, y)));
+                        if(wfc.failed()){
+                            return false;
+                        }
+                    }
+                }
+            }
+
+            if(!wfc.solve(-1, settings.backtrack)){
+                return false;
+            }
+
+            for (size_t y=y0; y < y1; y++) {
+                for (size_t x=x0; x < x1; x++) {
+                    map(x, y) = wfc.grid.getTile(x - bx0, y - by0);
+                }
+            }
+            return true;
+        }
+
+        uint64_t chunkSeed(size_t cx, size_t cy, size_t attempt) const {
+            uint64_t seed = mSeed;
+            for (uint64_t value : {uint64_t(cx), uint64_t(cy), uint64_t(attempt)}) {
+                seed = splitmix64(seed ^ splitmix64(value));
+            }
+            return seed;
+        }
+    };
+}
@@ -0,0 +1,299 @@
+#pragma once
+
+#include <lufuWFC.hpp>
+
+#include <memory>
+#include <span>
+#include <unordered_map>
+
+namespace lufuWFC{
+
+    struct OverlapSettings{
+        size_t n = 3;        // Patterns are n x n pixels
+        size_t symmetry = 8; // 1 to 8: the sample, then its reflection and rotations
+        bool periodic = true; // The sample wraps around, every pixel starts a pattern
+    };
+
+    // Overlapping model: every n x n window of a sample image becomes a pattern and two patterns may be
+    // neighbors if they overlap by n - 1 rows or columns. The tiles of the tileset are the patterns, weighted
+    // by how often they appear. Decoding images is left to the caller, the sample is one 32 bit color per pixel
+    class OverlapModel{
+    public:
+        // Find the patterns of a sample and compile their tileset. Windows are found by a rolling hash and only
+        // compared pixel by pixel if their hashes match. Returns false for n below 2 or a sample smaller than a pattern
+        bool extract(std::span<const uint32_t> pixels, size_t width, size_t height, const OverlapSettings& settings){
+            mN = settings.n;
+            mPalette.clear();
+            mPatterns.clear();
+            mCounts.clear();
+            mTileset.reset();
+            if(mN < 2 or width == 0 or height == 0 or pixels.size() < width * height
+               or (!settings.periodic and (width < mN or height < mN))){
+                return false;
+            }
+
+            // Colors to palette indices
+            std::vector<uint32_t> sample(width * height);
+            std::unordered_map<uint32_t, uint32_t> colors;
+            for (size_t i=0; i < sample.size(); i++) {
+                auto [it, added] = colors.try_emplace(pixels[i], mPalette.size());
+                if(added) mPalette.push_back(pixels[i]);
+                sample[i] = it->second;
+            }
+
+            // The windows of a transformed sample are the transformed windows of the sample. Every rotation
+            // is followed by its reflection
+            Image rotation{std::move(sample), width, height};
+            HashIndex index;
+            size_t symmetry = std::clamp<size_t>(settings.symmetry, 1, 8);
+            for (size_t s=0; s < symmetry; s++) {
+                if(s % 2){
+                    addPatterns(reflect(rotation), settings.periodic, index);
+                    continue;
+                }
+                if(s > 0) rotation = rotate(rotation);
+                addPatterns(rotation, settings.periodic, index);
+            }
+
+            compileRules();
+            return true;
+        }
+
+        std::shared_ptr<const CompiledTileSet> tileset() const { return mTileset; }
+
+        size_t size() const { return mN; }
+        size_t patternCount() const { return mCounts.size(); }
+
+        // Palette indices of a pattern, row by row
+        std::span<const uint32_t> pattern(size_t p) const {
+            return std::span<const uint32_t>(mPatterns).subspan(p * mN * mN, mN * mN);
+        }
+
+        std::span<const uint32_t> palette() const { return mPalette; }
+
+        // Color every cell with the top left pixel of its pattern, 0 for cells without a tile
+        void render(const TileMap& map, std::vector<uint32_t>& pixels) const {
+            pixels.resize(map.mTiles.size());
+            for (size_t i=0; i < map.mTiles.size(); i++) {
+                int32_t tile = map.mTiles[i];
+                pixels[i] = tile >= 0 and static_cast<size_t>(tile) < patternCount() ? mPalette[mPatterns[tile * mN * mN]] : 0;
+            }
+        }
+
+    private:
+        struct Image{
+            std::vector<uint32_t> pixels;
+            size_t width = 0, height = 0;
+
+            uint32_t at(size_t x, size_t y) const { return pixels[(y % height) * width + x % width]; }
+        };
+
+        // Open addressing table from 64 bit hashes to ids. equal is only asked for entries with the same hash
+        class HashIndex{
+        public:
+            static constexpr uint32_t none = UINT32_MAX;
+
+            template<typename Equal>
+            uint32_t find(uint64_t hash, Equal equal) const {
+                if(mSlots.empty()) return none;
+                for (size_t at=splitmix64(hash) & (mSlots.size() - 1); mSlots[at].id != none; at=(at + 1) & (mSlots.size() - 1)) {
+                    if(mSlots[at].hash == hash and equal(mSlots[at].id)) return mSlots[at].id;
+                }
+                return none;
+            }
+
+            void insert(uint64_t hash, uint32_t id){
+                if((mCount + 1) * 2 > mSlots.size()){
+                    std::vector<Slot> slots(std::max<size_t>(mSlots.size() * 2, 1024));
+                    std::swap(slots, mSlots);
+                    for (const Slot& slot : slots) {
+                        if(slot.id != none) place(slot);
+                    }
+                }
+                place({hash, id});
+                mCount++;
+            }
+
+        private:
+            struct Slot{
+                uint64_t hash = 0;
+                uint32_t id = none;
+            };
+
+            std::vector<Slot> mSlots;
+            size_t mCount = 0;
+
+            void place(const Slot& slot){
+                size_t at = splitmix64(slot.hash) & (mSlots.size() - 1);
+                while (mSlots[at].id != none) at = (at + 1) & (mSlots.size() - 1);
+                mSlots[at] = slot;
+            }
+        };
+
+        // Bases of the polynomial hash over rows and over columns, mod 2^64
+        static constexpr uint64_t rowBase = 0x9e3779b97f4a7c15ull;
+        static constexpr uint64_t columnBase = 0xc2b2ae3d27d4eb4full;
+
+        size_t mN = 0;
+        std::vector<uint32_t> mPalette;
+        std::vector<uint32_t> mPatterns; // n * n palette indices per pattern
+        std::vector<double> mCounts;
+        std::shared_ptr<const CompiledTileSet> mTileset;
+
+        static Image reflect(const Image& image){
+            Image out{std::vector<uint32_t>(image.pixels.size()), image.width, image.height};
+            for (size_t y=0; y < image.height; y++) {
+                for (size_t x=0; x < image.width; x++) {
+                    out.pixels[y * out.width + x] = image.at(image.width - 1 - x, y);
+                }
+            }
+            return out;
+        }
+
+        static Image rotate(const Image& image){
+            Image out{std::vector<uint32_t>(image.pixels.size()), image.height, image.width};
+            for (size_t y=0; y < out.height; y++) {
+                for (size_t x=0; x < out.width; x++) {
+                    out.pixels[y * out.width + x] = image.at(image.width - 1 - y, x);
+                }
+            }
+            return out;
+        }
+
+        static uint64_t power(uint64_t base, size_t exponent){
+            uint64_t result = 1;
+            for (size_t i=0; i < exponent; i++) result *= base;
+            return result;
+        }
+
+        // Hash every window of an image in two rolling passes: windows of n pixels along the rows, then n of
+        // those down the columns. A window is only read pixel by pixel if its hash is already in the index
+        void addPatterns(const Image& image, bool periodic, HashIndex& index){
+            size_t n = mN;
+            size_t countX = periodic ? image.width : image.width - n + 1;
+            size_t countY = periodic ? image.height : image.height - n + 1;
+            size_t rowsNeeded = countY + n - 1;
+            uint64_t rowHigh = power(rowBase, n - 1), columnHigh = power(columnBase, n - 1);
+
+            // Hashes of the n pixels starting at every x of every row, the rows past the bottom wrap around
+            std::vector<uint64_t> rowHashes(rowsNeeded * countX);
+            for (size_t y=0; y < rowsNeeded; y++) {
+                uint64_t hash = 0;
+                for (size_t x=0; x + 1 < n; x++) hash = hash * rowBase + image.at(x, y) + 1;
+                for (size_t x=0; x < countX; x++) {
+                    hash = hash * rowBase + image.at(x + n - 1, y) + 1;
+                    rowHashes[y * countX + x] = hash;
+                    hash -= (image.at(x, y) + uint64_t(1)) * rowHigh;
+                }
+            }
+
+            std::vector<uint64_t> hashes(countX);
+            for (size_t x=0; x < countX; x++) {
+                for (size_t y=0; y + 1 < n; y++) hashes[x] = hashes[x] * columnBase + rowHashes[y * countX + x];
+            }
+            for (size_t y=0; y < countY; y++) {
+                for (size_t x=0; x < countX; x++) {
+                    uint64_t hash = hashes[x] * columnBase + rowHashes[(y + n - 1) * countX + x];
+                    hashes[x] = hash - rowHashes[y * countX + x] * columnHigh;
+
+                    uint32_t id = index.find(hash, [&](uint32_t p){
+                        const uint32_t* stored = &mPatterns[p * n * n];
+                        for (size_t dy=0; dy < n; dy++) {
+                            for (size_t dx=0; dx < n; dx++) {
+                                if(stored[dy * n + dx] != image.at(x + dx, y + dy)) return false;
+                            }
+                        }
+                        return true;
+                    });
+                    if(id == HashIndex::none){
+                        id = mCounts.size();
+                        for (size_t dy=0; dy < n; dy++) {
+                            for (size_t dx=0; dx < n; dx++) mPatterns.push_back(image.at(x + dx, y + dy));
+                        }
+                        mCounts.push_back(0);
+                        index.insert(hash, id);
+                    }
+                    mCounts[id]++;
+                }
+            }
+        }
+
+        // Ids of the parts of every pattern, part(p, offsetX, offsetY) are the width x height pixels at the offset.
+        // Equal parts get the same id
+        std::vector<uint32_t> partIds(size_t width, size_t height, size_t offsetX, size_t offsetY, std::vector<uint32_t>& parts, HashIndex& index) const {
+            size_t n = mN, count = patternCount();
+            std::vector<uint32_t> ids(count);
+            auto pixel = [&](size_t p, size_t x, size_t y){ return mPatterns[p * n * n + (y + offsetY) * n + x + offsetX]; };
+            for (size_t p=0; p < count; p++) {
+                uint64_t hash = 0;
+                for (size_t y=0; y < height; y++) {
+                    for (size_t x=0; x < width; x++) hash = hash * rowBase + pixel(p, x, y) + 1;
+                }
+                uint32_t id = index.find(hash, [&](uint32_t part){
+                    for (size_t y=0; y < height; y++) {
+                        for (size_t x=0; x < width; x++) {
+                            if(parts[part * width * height + y * width + x] != pixel(p, x, y)) return false;
+                        }
+                    }
+                    return true;
+                });
+                if(id == HashIndex::none){
+                    id = parts.size() / (width * height);
+                    for (size_t y=0; y < height; y++) {
+                        for (size_t x=0; x < width; x++) parts.push_back(pixel(p, x, y));
+                    }
+                    index.insert(hash, id);
+                }
+                ids[p] = id;
+            }
+            return ids;
+        }
+
+        // Two patterns overlap if the part of one equals the opposite part of the other. The patterns are grouped
+        // by their parts, the compatible patterns of a direction are the group of the matching part
+        void compileRules(){
+            size_t n = mN, count = patternCount();
+
+            // Top and bottom are n x (n - 1), left and right (n - 1) x n, they get their own ids
+            HashIndex rows, columns;
+            std::vector<uint32_t> rowParts, columnParts;
+            std::vector<uint32_t> top = partIds(n, n - 1, 0, 0, rowParts, rows);
+            std::vector<uint32_t> bottom = partIds(n, n - 1, 0, 1, rowParts, rows);
+            std::vector<uint32_t> left = partIds(n - 1, n, 0, 0, columnParts, columns);
+            std::vector<uint32_t> right = partIds(n - 1, n, 1, 0, columnParts, columns);
+            size_t rowCount = rowParts.size() / (n * (n - 1));
+            size_t columnCount = columnParts.size() / (n * (n - 1));
+
+            // Patterns by part id, in pattern order so every list is sorted
+            auto group = [&](const std::vector<uint32_t>& ids, size_t partCount, std::vector<uint32_t>& offsets, std::vector<uint32_t>& members){
+                offsets.assign(partCount + 1, 0);
+                for (uint32_t id : ids) offsets[id + 1]++;
+                for (size_t i=0; i < partCount; i++) offsets[i + 1] += offsets[i];
+                members.resize(count);
+                std::vector<uint32_t> at(offsets.begin(), offsets.end() - 1);
+                for (size_t p=0; p < count; p++) members[at[ids[p]]++] = p;
+            };
+            std::vector<uint32_t> byTop, byTopOffsets, byBottom, byBottomOffsets, byLeft, byLeftOffsets, byRight, byRightOffsets;
+            group(top, rowCount, byTopOffsets, byTop);
+            group(bottom, rowCount, byBottomOffsets, byBottom);
+            group(left, columnCount, byLeftOffsets, byLeft);
+            group(right, columnCount, byRightOffsets, byRight);
+
+            // North of a is every b whose bottom is the top of a, and so on
+            std::vector<uint32_t> offsets(4 * count + 1, 0);
+            std::vector<uint32_t> compatible;
+            auto add = [&](size_t d, size_t p, const std::vector<uint32_t>& members, const std::vector<uint32_t>& memberOffsets, uint32_t id){
+                compatible.insert(compatible.end(), members.begin() + memberOffsets[id], members.begin() + memberOffsets[id + 1]);
+                offsets[d * count + p + 1] = compatible.size();
+            };
+            for (size_t p=0; p < count; p++) add(0, p, byBottom, byBottomOffsets, top[p]);
+            for (size_t p=0; p < count; p++) add(1, p, byLeft, byLeftOffsets, right[p]);
+            for (size_t p=0; p < count; p++) add(2, p, byTop, byTopOffsets, bottom[p]);
+            for (size_t p=0; p < count; p++) add(3, p, byRight, byRightOffsets, left[p]);
+
+            auto tileset = std::make_shared<CompiledTileSet>();
+            tileset->compile(4, mCounts, offsets, compatible);
+            mTileset = std::move(tileset);
+        }
+    };
+}
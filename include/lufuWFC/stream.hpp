@@ -0,0 +1,139 @@
+#pragma once
+
+#include <lufuWFC.hpp>
+
+#include <functional>
+#include <memory>
+#include <span>
+#include <variant>
+
+namespace lufuWFC{
+
+    struct StreamSettings{
+        size_t width = 64;
+        size_t rowsPerBlock = 16; // Rows committed by one solve
+        size_t lookahead = 8;     // Rows solved below the block but thrown away, they keep the block extendable
+        size_t retries = 8;       // Extra seeds tried per block
+        int backtrack = 1000;
+        SearchStrategy strategy;
+        Propagator propagator = Propagator::Bitset;
+    };
+
+    // Generates an endless strip of width columns one block of rows at a time. Every block is solved in a window
+    // that starts with the last committed row, set like manualSetCell would, so the strip has no seams.
+    // Only the window and the current block are kept, memory doesn't depend on how many rows were generated.
+    // Every block gets its own seed, so the strip only depends on the seed. Only square tilesets are supported
+    class StreamGenerator{
+    public:
+        StreamSettings settings;
+
+        StreamGenerator(std::shared_ptr<const CompiledTileSet> tileset, const StreamSettings& streamSettings): settings(streamSettings), mTileset(std::move(tileset)){
+            withSolverWords(*mTileset, [&](auto words){
+                mSolver.template emplace<BasicWFC<decltype(words)::value>>();
+            });
+            std::visit([&](auto& wfc){
+                wfc.setSink(nullptr);
+                // Every window after the first has the same shape
+                wfc.setPresolveCache(std::make_shared<PresolveCache>());
+            }, mSolver);
+            reset(0);
+        }
+
+        // Start a new strip
+        void reset(uint64_t seed){
+            mSeed = seed;
+            mBlock = 0;
+            mFirstRow = 0;
+            mRows.clear();
+            mLastRow.clear();
+        }
+
+        // Solve and commit the next block. Returns false if it couldn't be solved with any of its seeds,
+        // the strip can't continue then
+        bool next(){
+            if(mTileset->directionCount != 4 or settings.width == 0 or settings.rowsPerBlock == 0){
+                return false;
+            }
+
+            mFirstRow += rowCount();
+            bool solved = std::visit([&](auto& wfc){
+                wfc.setSearchStrategy(settings.strategy);
+                wfc.setPropagator(settings.propagator);
+                for (size_t attempt=0; attempt <= settings.retries; attempt++) {
+                    if(solveBlock(wfc, blockSeed(mBlock, attempt))){
+                        return true;
+                    }
+                }
+                return false;
+            }, mSolver);
+
+            if(!solved){
+                mRows.clear();
+                return false;
+            }
+            mBlock++;
+            return true;
+        }
+
+        // Rows of the last block, row by row. Empty before the first next or after a failed one
+        std::span<const int32_t> rows() const { return mRows; }
+        size_t rowCount() const { return mRows.size() / settings.width; }
+        // Index of the first row of the last block in the strip
+        size_t firstRow() const { return mFirstRow; }
+
+        // Generate height rows and hand every block to onRows(firstRow, rows), the last block is cut to fit.
+        // Returns false if the strip couldn't be continued
+        bool generate(uint64_t seed, size_t height, const std::function<void(size_t, std::span<const int32_t>)>& onRows){
+            reset(seed);
+            while (mFirstRow + rowCount() < height) {
+                if(!next()){
+                    return false;
+                }
+                size_t count = std::min(rowCount(), height - mFirstRow);
+                onRows(mFirstRow, rows().first(count * settings.width));
+            }
+            return true;
+        }
+
+    private:
+        std::shared_ptr<const CompiledTileSet> mTileset;
+        std::variant<BasicWFC<0>, BasicWFC<1>, BasicWFC<2>, BasicWFC<3>, BasicWFC<4>> mSolver;
+        TileMap mWindow;
+        std::vector<int32_t> mRows;
+        std::vector<int32_t> mLastRow; // Last committed row, the first row of the next window
+        uint64_t mSeed = 0;
+        size_t mBlock = 0;
+        size_t mFirstRow = 0;
+
+        template<typename Solver>
+        bool solveBlock(Solver& wfc, uint64_t seed){
+            size_t context = mLastRow.empty() ? 0 : 1;
+            size_t width = settings.width;
+            wfc.initialize(width, context + settings.rowsPerBlock + settings.lookahead, seed, mTileset);
+
+            for (size_t x=0; x < width and context > 0; x++) {
+                wfc.manualSetCell(x, 0, static_cast<size_t>(mLastRow[x]));
+                if(wfc.failed()){
+                    return false;
+                }
+            }
+            if(!wfc.solve(-1, settings.backtrack)){
+                return false;
+            }
+
+            wfc.getTiles(mWindow);
+            auto block = mWindow.mTiles.begin() + context * width;
+            mRows.assign(block, block + settings.rowsPerBlock * width);
+            mLastRow.assign(mRows.end() - width, mRows.end());
+            return true;
+        }
+
+        uint64_t blockSeed(size_t block, size_t attempt) const {
+            uint64_t seed = mSeed;
+            for (uint64_t value : {uint64_t(block), uint64_t(attempt)}) {
+                seed = splitmix64(seed ^ splitmix64(value));
+            }
+            return seed;
+        }
+    };
+}
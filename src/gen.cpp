@@ -0,0 +1,408 @@
+// lufuwfc-gen: headless batch generator
+//
+// Solves a range of seeds of one tileset on all cores and writes every solved grid as a binary file.
+//   raw:     width * height little endian int32 tile indices, row by row
+//   compact: "LWFC" header followed by the tiles bit packed, see writeCompact
+// The tileset can be JSON or a compiled tileset written with --compile, which is mapped instead of parsed.
+// With --stream the rows are written as soon as they are solved, so the height only costs time, not memory.
+// With --overlap the input is a binary PPM sample and the tiles are its N x N patterns, see lufuWFC/overlap.hpp.
+//   ppm:     the solved grid as a binary PPM image, only with --overlap
+
+#include <lufuWFC.hpp>
+#include <lufuWFC/batch.hpp>
+#include <lufuWFC/chunks.hpp>
+#include <lufuWFC/overlap.hpp>
+#include <lufuWFC/stream.hpp>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <vector>
+#include <map>
+
+using namespace lufuWFC;
+
+struct Options{
+    std::string tileset;
+    size_t width = 64, height = 64;
+    uint64_t firstSeed = 0, lastSeed = 1;
+    size_t threads = std::thread::hardware_concurrency();
+    int backtrack = 1000;
+    size_t chunk = 0; // Solve every map in chunks of this size, 0 = one solve per map
+    bool stream = false;
+    bool compact = false;
+    bool ppm = false;
+    size_t overlap = 0; // Pattern size of an overlapping model, 0 = the input is a tileset
+    size_t symmetry = 8;
+    bool keepFailed = false;
+    bool verbose = false;
+    std::string output = "-";
+    std::string compileTo; // Only compile the tileset into this file
+    SearchStrategy strategy;
+};
+
+static void usage(){
+    std::fprintf(stderr,
+        "Usage: lufuwfc-gen <tileset.json | tileset.lwfct | sample.ppm> [options]\n"
+        "  -s, --size WxH          Grid size (default 64x64)\n"
+        "  -S, --seeds A[:B]       Seed A or the seeds [A, B) (default 0)\n"
+        "  -t, --threads N         Worker threads (default all cores)\n"
+        "  -b, --backtrack N       Backtrack budget of every map (default 1000)\n"
+        "  -f, --format raw|compact|ppm\n"
+        "  -o, --output PATH       File to write, {seed} is replaced by the seed. - writes to stdout (default)\n"
+        "      --chunk N           Solve every map in NxN chunks, useful for very large maps\n"
+        "      --stream            Solve every map in blocks of rows and write them right away, raw format only\n"
+        "      --restart luby|geometric\n"
+        "      --scan              Scanline tie breaking\n"
+        "      --backjump          Conflict-directed backjumping instead of chronological backtracking\n"
+        "      --overlap N         The input is a binary PPM sample, the tiles are its NxN patterns\n"
+        "      --symmetry N        Rotations and reflections of the sample to use, 1 to 8 (default 8)\n"
+        "      --keep-failed       Also write maps that couldn't be solved, unsolved cells are -1\n"
+        "  -v, --verbose           Print the solver log to stderr\n"
+        "      --compile FILE      Write the tileset as a compiled binary tileset and exit\n");
+}
+
+static bool parseSize(const char* text, size_t& width, size_t& height){
+    return std::sscanf(text, "%zux%zu", &width, &height) == 2 and width > 0 and height > 0;
+}
+
+static bool parseSeeds(const char* text, uint64_t& first, uint64_t& last){
+    unsigned long long a = 0, b = 0;
+    int fields = std::sscanf(text, "%llu:%llu", &a, &b);
+    if(fields == 1){
+        b = a + 1;
+    }
+    first = a;
+    last = b;
+    return fields >= 1 and b > a;
+}
+
+static bool parseOptions(int argc, char** argv, Options& options){
+    for (int i=1; i < argc; i++) {
+        std::string arg = argv[i];
+        auto value = [&]() -> const char* {
+            return i + 1 < argc ? argv[++i] : nullptr;
+        };
+
+        const char* v = nullptr;
+        if(arg == "-s" or arg == "--size"){
+            if(!(v = value()) or !parseSize(v, options.width, options.height)) return false;
+        } else if(arg == "-S" or arg == "--seeds"){
+            if(!(v = value()) or !parseSeeds(v, options.firstSeed, options.lastSeed)) return false;
+        } else if(arg == "-t" or arg == "--threads"){
+            if(!(v = value())) return false;
+            options.threads = std::max(std::atoi(v), 1);
+        } else if(arg == "-b" or arg == "--backtrack"){
+            if(!(v = value())) return false;
+            options.backtrack = std::atoi(v);
+        } else if(arg == "-f" or arg == "--format"){
+            if(!(v = value()) or (std::strcmp(v, "raw") != 0 and std::strcmp(v, "compact") != 0 and std::strcmp(v, "ppm") != 0)) return false;
+            options.compact = std::strcmp(v, "compact") == 0;
+            options.ppm = std::strcmp(v, "ppm") == 0;
+        } else if(arg == "-o" or arg == "--output"){
+            if(!(v = value())) return false;
+            options.output = v;
+        } else if(arg == "--chunk"){
+            if(!(v = value())) return false;
+            options.chunk = std::max(std::atoi(v), 0);
+        } else if(arg == "--stream"){
+            options.stream = true;
+        } else if(arg == "--restart"){
+            if(!(v = value())) return false;
+            if(std::strcmp(v, "luby") == 0) options.strategy.restart = SearchStrategy::Restart::Luby;
+            else if(std::strcmp(v, "geometric") == 0) options.strategy.restart = SearchStrategy::Restart::Geometric;
+            else return false;
+        } else if(arg == "--scan"){
+            options.strategy.tieBreak = SearchStrategy::TieBreak::Scan;
+        } else if(arg == "--backjump"){
+            options.strategy.backjumping = true;
+        } else if(arg == "--compile"){
+            if(!(v = value())) return false;
+            options.compileTo = v;
+        } else if(arg == "--overlap"){
+            if(!(v = value()) or std::atoi(v) < 2) return false;
+            options.overlap = std::atoi(v);
+        } else if(arg == "--symmetry"){
+            if(!(v = value()) or std::atoi(v) < 1 or std::atoi(v) > 8) return false;
+            options.symmetry = std::atoi(v);
+        } else if(arg == "--keep-failed"){
+            options.keepFailed = true;
+        } else if(arg == "-v" or arg == "--verbose"){
+            options.verbose = true;
+        } else if(options.tileset.empty() and arg[0] != '-'){
+            options.tileset = arg;
+        } else {
+            return false;
+        }
+    }
+    return !options.tileset.empty();
+}
+
+static void put32(std::vector<uint8_t>& out, uint32_t value){
+    for (int i=0; i < 4; i++) out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+}
+
+static void put64(std::vector<uint8_t>& out, uint64_t value){
+    for (int i=0; i < 8; i++) out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+}
+
+static void writeRaw(const TileMap& map, std::vector<uint8_t>& out){
+    out.reserve(out.size() + map.mTiles.size() * 4);
+    for (int32_t tile : map.mTiles) {
+        put32(out, static_cast<uint32_t>(tile));
+    }
+}
+
+// Header: "LWFC", version 1, width, height (uint32), seed (uint64), bits per cell (uint32).
+// Then every cell stores tile + 1 with the given bits, least significant bit first, so 0 is an unsolved cell
+static void writeCompact(const TileMap& map, uint64_t seed, size_t tileCount, std::vector<uint8_t>& out){
+    uint32_t bits = std::bit_width(tileCount);
+    out.insert(out.end(), {'L', 'W', 'F', 'C'});
+    put32(out, 1);
+    put32(out, map.mX);
+    put32(out, map.mY);
+    put64(out, seed);
+    put32(out, bits);
+
+    uint64_t buffer = 0;
+    uint32_t filled = 0;
+    for (int32_t tile : map.mTiles) {
+        buffer |= uint64_t(tile + 1) << filled;
+        filled += bits;
+        while (filled >= 8) {
+            out.push_back(static_cast<uint8_t>(buffer));
+            buffer >>= 8;
+            filled -= 8;
+        }
+    }
+    if(filled > 0){
+        out.push_back(static_cast<uint8_t>(buffer));
+    }
+}
+
+// Binary PPM (P6) with a maximum value of 255, pixels as 0xRRGGBB
+static bool readPpm(const std::string& path, std::vector<uint32_t>& pixels, size_t& width, size_t& height){
+    std::ifstream file(path, std::ios::binary);
+    std::string magic;
+    int maxValue = 0;
+    auto skipComments = [&]{
+        while (file >> std::ws and file.peek() == '#') {
+            file.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+        }
+    };
+    file >> magic;
+    skipComments();
+    file >> width;
+    skipComments();
+    file >> height;
+    skipComments();
+    file >> maxValue;
+    file.get();
+    if(!file or magic != "P6" or maxValue != 255 or width == 0 or height == 0){
+        return false;
+    }
+
+    std::vector<uint8_t> data(width * height * 3);
+    if(!file.read(reinterpret_cast<char*>(data.data()), data.size())){
+        return false;
+    }
+    pixels.resize(width * height);
+    for (size_t i=0; i < pixels.size(); i++) {
+        pixels[i] = uint32_t(data[3 * i]) << 16 | uint32_t(data[3 * i + 1]) << 8 | data[3 * i + 2];
+    }
+    return true;
+}
+
+static void writePpm(const TileMap& map, const OverlapModel& model, std::vector<uint8_t>& out){
+    std::vector<uint32_t> pixels;
+    model.render(map, pixels);
+    std::string header = "P6\n" + std::to_string(map.mX) + " " + std::to_string(map.mY) + "\n255\n";
+    out.insert(out.end(), header.begin(), header.end());
+    for (uint32_t pixel : pixels) {
+        out.insert(out.end(), {static_cast<uint8_t>(pixel >> 16), static_cast<uint8_t>(pixel >> 8), static_cast<uint8_t>(pixel)});
+    }
+}
+
+static std::string outputPath(const std::string& pattern, uint64_t seed){
+    std::string path = pattern;
+    size_t at = path.find("{seed}");
+    if(at != std::string::npos){
+        path.replace(at, 6, std::to_string(seed));
+    }
+    return path;
+}
+
+int main(int argc, char** argv){
+    Options options;
+    if(!parseOptions(argc, argv, options)){
+        usage();
+        return 2;
+    }
+
+    bool toStdout = options.output == "-";
+    if(!toStdout and options.lastSeed - options.firstSeed > 1 and options.output.find("{seed}") == std::string::npos){
+        std::fprintf(stderr, "The output needs a {seed} placeholder when writing more than one seed\n");
+        return 2;
+    }
+
+    if(options.ppm and options.overlap == 0){
+        std::fprintf(stderr, "The ppm format needs --overlap\n");
+        return 2;
+    }
+
+    if(options.stream and (options.compact or options.ppm or options.chunk > 0)){
+        std::fprintf(stderr, "--stream only writes the raw format and can't be combined with --chunk\n");
+        return 2;
+    }
+
+    setLogStream(options.verbose ? &std::cerr : nullptr);
+
+    auto tiles = std::make_shared<CompiledTileSet>();
+    OverlapModel model;
+    if(options.overlap > 0){
+        std::vector<uint32_t> pixels;
+        size_t width = 0, height = 0;
+        if(!readPpm(options.tileset, pixels, width, height)){
+            std::fprintf(stderr, "%s is not a binary PPM image\n", options.tileset.c_str());
+            return 1;
+        }
+        if(!model.extract(pixels, width, height, {options.overlap, options.symmetry, true})){
+            std::fprintf(stderr, "Can't extract %zux%zu patterns from %s\n", options.overlap, options.overlap, options.tileset.c_str());
+            return 1;
+        }
+        std::fprintf(stderr, "Extracted %zu patterns\n", model.patternCount());
+    } else if(CompiledTileSet::isCompiled(options.tileset)){
+        if(!tiles->load(options.tileset)){
+            std::fprintf(stderr, "%s is not a valid compiled tileset\n", options.tileset.c_str());
+            return 1;
+        }
+    } else {
+        TileSet tileset;
+        if(!tileset.loadFromFile(options.tileset)){
+            return 1;
+        }
+        tiles->compile(tileset);
+    }
+
+    std::shared_ptr<const CompiledTileSet> compiled = options.overlap > 0 ? model.tileset() : tiles;
+
+    if(!options.compileTo.empty()){
+        if(!compiled->save(options.compileTo)){
+            std::fprintf(stderr, "Can't write %s\n", options.compileTo.c_str());
+            return 1;
+        }
+        std::fprintf(stderr, "Compiled %zu tiles into %s\n", compiled->tileCount, options.compileTo.c_str());
+        return 0;
+    }
+
+    // Maps written to stdout keep the seed order, finished maps wait here until it is their turn
+    std::map<uint64_t, std::vector<uint8_t>> waiting;
+    uint64_t nextToWrite = options.firstSeed;
+    size_t written = 0, failed = 0;
+    bool ioError = false;
+
+    auto emit = [&](uint64_t seed, bool solved, const TileMap& map){
+        if(!solved){
+            failed++;
+            std::fprintf(stderr, "Seed %llu couldn't be solved\n", static_cast<unsigned long long>(seed));
+        }
+
+        std::vector<uint8_t> data;
+        if(solved or options.keepFailed){
+            if(options.compact) writeCompact(map, seed, compiled->tileCount, data);
+            else if(options.ppm) writePpm(map, model, data);
+            else writeRaw(map, data);
+            written++;
+        }
+
+        if(!toStdout){
+            if(data.empty()) return;
+            std::string path = outputPath(options.output, seed);
+            FILE* file = std::fopen(path.c_str(), "wb");
+            if(!file or std::fwrite(data.data(), 1, data.size(), file) != data.size()){
+                std::fprintf(stderr, "Can't write %s\n", path.c_str());
+                ioError = true;
+            }
+            if(file) std::fclose(file);
+            return;
+        }
+
+        waiting[seed] = std::move(data);
+        for (auto it=waiting.begin(); it != waiting.end() and it->first == nextToWrite; it=waiting.erase(it)) {
+            if(std::fwrite(it->second.data(), 1, it->second.size(), stdout) != it->second.size()){
+                ioError = true;
+            }
+            nextToWrite++;
+        }
+    };
+
+    if(options.stream){
+        // One row block at a time, written before the next one is solved
+        StreamSettings settings;
+        settings.width = options.width;
+        settings.backtrack = options.backtrack;
+        settings.strategy = options.strategy;
+        StreamGenerator generator(compiled, settings);
+
+        std::vector<uint8_t> data;
+        for (uint64_t seed=options.firstSeed; seed < options.lastSeed; seed++) {
+            std::string path = outputPath(options.output, seed);
+            FILE* file = toStdout ? stdout : std::fopen(path.c_str(), "wb");
+            if(!file){
+                std::fprintf(stderr, "Can't write %s\n", path.c_str());
+                ioError = true;
+                continue;
+            }
+
+            bool solved = generator.generate(seed, options.height, [&](size_t, std::span<const int32_t> rows){
+                data.clear();
+                for (int32_t tile : rows) {
+                    put32(data, static_cast<uint32_t>(tile));
+                }
+                if(std::fwrite(data.data(), 1, data.size(), file) != data.size()){
+                    ioError = true;
+                }
+            });
+            if(!toStdout) std::fclose(file);
+
+            if(solved){
+                written++;
+            } else {
+                failed++;
+                std::fprintf(stderr, "Seed %llu couldn't be solved, the rows before the failure were written\n", static_cast<unsigned long long>(seed));
+            }
+        }
+    } else if(options.chunk > 0){
+        // The threads go into the chunks of one map at a time
+        ChunkSettings settings;
+        settings.chunkSize = options.chunk;
+        settings.threads = options.threads;
+        settings.backtrack = options.backtrack;
+        settings.strategy = options.strategy;
+        ChunkGenerator generator(settings);
+
+        TileMap map;
+        for (uint64_t seed=options.firstSeed; seed < options.lastSeed; seed++) {
+            bool solved = generator.generate(options.width, options.height, seed, compiled, map);
+            emit(seed, solved, map);
+        }
+    } else {
+        BatchSettings settings;
+        settings.width = options.width;
+        settings.height = options.height;
+        settings.backtrack = options.backtrack;
+        settings.threads = options.threads;
+        settings.strategy = options.strategy;
+
+        BatchSolver solver(compiled, settings);
+        solver.run(options.firstSeed, options.lastSeed, [&](const BatchResult& result){
+            emit(result.seed, result.solved, result.map);
+        });
+    }
+    std::fflush(stdout);
+
+    std::fprintf(stderr, "%zu maps written, %zu failed\n", written, failed);
+    return ioError ? 1 : failed > 0 ? 3 : 0;
+}
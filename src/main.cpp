@@ -5,69 +5,74 @@
 #define RAYGUI_IMPLEMENTATION
 #include <raygui.h>
 
-void drawGridLandTiles(const lufuWFC::Grid& grid){
-    int size = 15;
-    Color colors[10] = {YELLOW, BLUE, BROWN, GREEN, GRAY, PURPLE, RED};
-
-    for (size_t x=0; x<grid.mX; x++) {
-        for (size_t y=0; y<grid.mY; y++) {
-            if(grid(x,y).collapsed){
-                DrawRectangle(x*size, y*size, size, size, colors[grid(x,y).possibleTiles[0]]);
-            } else {
-                DrawRectangle(x*size, y*size, size, size, BLACK);
-                std::string text = std::to_string(grid(x,y).possibleTiles.size());
-
-                DrawText(text.c_str(), x*size, y*size + size/2, 3, WHITE);
-            }
+// Draw one tile into its slot of the atlas. Street tiles are named after the sides their street leaves
+// through, e.g. streetUpRight, every other tile is a plain color
+void drawAtlasTile(Image& atlas, std::string_view name, int x, int size){
+    static const std::pair<std::string_view, Color> colors[] = {
+        {"sand", YELLOW}, {"water", BLUE}, {"dirt", BROWN}, {"grass", GREEN}, {"mountain", GRAY}, {"spacer", GRAY}
+    };
+
+    if(name.starts_with("street")){
+        int width = std::max(size / 4, 1), center = (size - width) / 2;
+        ImageDrawRectangle(&atlas, x, 0, size, size, WHITE);
+        if(name.find("Up") != std::string_view::npos) ImageDrawRectangle(&atlas, x + center, 0, width, center + width, BLACK);
+        if(name.find("Down") != std::string_view::npos) ImageDrawRectangle(&atlas, x + center, center, width, size - center, BLACK);
+        if(name.find("Left") != std::string_view::npos) ImageDrawRectangle(&atlas, x, center, center + width, width, BLACK);
+        if(name.find("Right") != std::string_view::npos) ImageDrawRectangle(&atlas, x + center, center, size - center, width, BLACK);
+        return;
+    }
+
+    for (auto [tileName, color] : colors) {
+        if(name == tileName){
+            ImageDrawRectangle(&atlas, x, 0, size, size, color);
+            return;
         }
     }
+    // Unknown tiles get a color from their name
+    uint32_t hash = 2166136261u;
+    for (char c : name) hash = (hash ^ static_cast<uint8_t>(c)) * 16777619u;
+    ImageDrawRectangle(&atlas, x, 0, size, size, {static_cast<unsigned char>(hash), static_cast<unsigned char>(hash >> 8), static_cast<unsigned char>(hash >> 16), 255});
 }
 
-void drawGridPathTiles(const lufuWFC::Grid& grid){
-    int size = 8;
-
-    for (size_t x=0; x<grid.mX; x++) {
-        for (size_t y=0; y<grid.mY; y++) {
-            if(grid(x,y).collapsed){
-                Vector2 up = {static_cast<float>(x*size) +static_cast<float>(size)/2.f, static_cast<float>(y*size)};
-                Vector2 down = {static_cast<float>(x*size) +static_cast<float>(size)/2.f, static_cast<float>(y*size + size)};
-                Vector2 right = {static_cast<float>(x*size + size), static_cast<float>(y*size) +static_cast<float>(size)/2.f};
-                Vector2 left = {static_cast<float>(x*size), static_cast<float>(y*size) +static_cast<float>(size)/2.f};
-
-                if(grid(x,y).possibleTiles[0] == 0){
-                    DrawRectangle(x*size, y*size, size, size, GRAY);
-                } else if(grid(x,y).possibleTiles[0] == 1){
-                    DrawRectangle(x*size, y*size, size, size, WHITE);
-                    DrawLineEx(up, down, 2, BLACK);
-
-                } else if(grid(x,y).possibleTiles[0] == 2){
-                    DrawRectangle(x*size, y*size, size, size, WHITE);
-                    DrawLineEx(right, left, 2, BLACK);
-                    
-                } else if(grid(x,y).possibleTiles[0] == 3){
-                    DrawRectangle(x*size, y*size, size, size, WHITE);
-                    DrawLineEx(up, right, 2, BLACK);
-
-                } else if(grid(x,y).possibleTiles[0] == 4){
-                    DrawRectangle(x*size, y*size, size, size, WHITE);
-                    DrawLineEx(right, down, 2, BLACK);
-
-                } else if(grid(x,y).possibleTiles[0] == 5){
-                    DrawRectangle(x*size, y*size, size, size, WHITE);
-                    DrawLineEx(down, left, 2, BLACK);
-
-                } else if(grid(x,y).possibleTiles[0] == 6){
-                    DrawRectangle(x*size, y*size, size, size, WHITE);
-                    DrawLineEx(left, up, 2, BLACK);
+// Every tile drawn once, side by side. Collapsed cells are copied out of it
+Texture2D buildAtlas(const lufuWFC::TileSet& tileset, int size){
+    Image atlas = GenImageColor(size * static_cast<int>(tileset.tiles.size()), size, BLACK);
+    for (size_t t=0; t < tileset.tiles.size(); t++) {
+        drawAtlasTile(atlas, tileset.tiles[t].name, static_cast<int>(t) * size, size);
+    }
+    Texture2D texture = LoadTextureFromImage(atlas);
+    UnloadImage(atlas);
+    return texture;
+}
 
-                }
-            } else {
-                DrawRectangle(x*size, y*size, size, size, BLACK);
-                std::string text = std::to_string(grid(x,y).possibleTiles.size());
+// Uncollapsed cells get brighter the more tiles they still have, cells without tiles are red
+Color entropyColor(size_t count, size_t tileCount){
+    if(count == 0){
+        return RED;
+    }
+    unsigned char value = static_cast<unsigned char>(40 + 120 * count / std::max<size_t>(tileCount, 1));
+    return {static_cast<unsigned char>(value / 3), static_cast<unsigned char>(value / 3), value, 255};
+}
 
-                DrawText(text.c_str(), x*size, y*size + size/2, 3, WHITE);
-            }
+// Draw cells into the canvas. With all every cell is drawn, cells still in full superposition are left to the clear
+void drawCells(const lufuWFC::Grid& grid, const Texture2D& atlas, int size, const std::vector<uint32_t>& cells, bool all){
+    auto draw = [&](size_t i){
+        float x = static_cast<float>(i % grid.mX * size), y = static_cast<float>(i / grid.mX * size);
+        if(grid.isCollapsed(i) and grid.firstTile(i) >= 0){
+            Rectangle source = {static_cast<float>(grid.firstTile(i) * size), 0, static_cast<float>(size), static_cast<float>(size)};
+            DrawTextureRec(atlas, source, {x, y}, WHITE);
+        } else {
+            DrawRectangle(static_cast<int>(x), static_cast<int>(y), size, size, entropyColor(grid.getEntropy(i), grid.mTileCount));
         }
+    };
+
+    if(all){
+        ClearBackground(entropyColor(grid.mTileCount, grid.mTileCount));
+        for (size_t i=0; i < grid.size(); i++) {
+            if(grid.isCollapsed(i) or grid.getEntropy(i) != grid.mTileCount) draw(i);
+        }
+    } else {
+        for (uint32_t i : cells) draw(i);
     }
 }
 
@@ -81,59 +86,122 @@ int main(void)
 
     const int screenWidth = 900;
     const int screenHeight = 900;
+    const int viewWidth = screenWidth - 140;
 
     InitWindow(screenWidth, screenHeight, "WFC Test");
 
     SetTargetFPS(60); // Set our game to run at 60 frames-per-second
     //--------------------------------------------------------------------------------------
 
-    
+
     lufuWFC::WFC wfc;
+    // The path tiles can't branch, scanning the grid avoids most dead ends
+    lufuWFC::SearchStrategy strategy;
+    strategy.tieBreak = lufuWFC::SearchStrategy::TieBreak::Scan;
+    wfc.setSearchStrategy(strategy);
+    // Only the cells that changed are drawn again
+    wfc.setChangeTracking(true);
     lufuWFC::TileSet tileset;
     tileset.loadFromFile("../../examples/pathtiles.json");
+    auto compiled = std::make_shared<const lufuWFC::CompiledTileSet>(tileset);
+
+    // The grid is drawn into the canvas at cellSize pixels per cell and scaled to the view
+    const int gridSizes[] = {64, 256, 1024, 2048};
+    size_t gridSizeIndex = 0;
+    int cellSize = 0;
+    Texture2D atlas{};
+    RenderTexture2D canvas{};
+    std::vector<uint32_t> changedCells;
 
     // Main game loop
     while (!WindowShouldClose()) // Detect window close button or ESC key
     {
         // Update
         //----------------------------------------------------------------------------------
+        // A running solve gets a few milliseconds of every frame, so the window stays responsive
+        wfc.solveFor({0.008});
+
+        float scale = canvas.id ? std::min(static_cast<float>(viewWidth) / canvas.texture.width, static_cast<float>(screenHeight) / canvas.texture.height) : 1;
 
+        // Right click solves the cells around the mouse again
+        if(IsMouseButtonPressed(MOUSE_BUTTON_RIGHT) and wfc.grid.size() > 0 and wfc.getProgress().status != lufuWFC::SolveStatus::Running){
+            Vector2 mouse = GetMousePosition();
+            int block = std::max(static_cast<int>(wfc.grid.mX) / 8, 8);
+            int x = static_cast<int>(mouse.x / (cellSize * scale)) - block / 2, y = static_cast<int>(mouse.y / (cellSize * scale)) - block / 2;
+            wfc.regenerate(std::max(x, 0), std::max(y, 0), block, block, 10);
+        }
         //----------------------------------------------------------------------------------
 
         // Draw
         //----------------------------------------------------------------------------------
+        if(canvas.id){
+            bool all = wfc.takeChangedCells(changedCells);
+            if(all or !changedCells.empty()){
+                BeginTextureMode(canvas);
+                    drawCells(wfc.grid, atlas, cellSize, changedCells, all);
+                EndTextureMode();
+            }
+        }
+
         BeginDrawing();
 
             ClearBackground(DARKBLUE);
 
-            if(wfc.grid.mData.size() > 0){
-                drawGridPathTiles(wfc.grid);
+            if(canvas.id){
+                // Render textures are upside down, the negative height flips them back
+                Rectangle source = {0, 0, static_cast<float>(canvas.texture.width), -static_cast<float>(canvas.texture.height)};
+                Rectangle target = {0, 0, canvas.texture.width * scale, canvas.texture.height * scale};
+                DrawTexturePro(canvas.texture, source, target, {0, 0}, 0, WHITE);
             }
 
             DrawRectangleRec({screenWidth - 140, 0, 140, screenHeight}, {200,190,200, 200});
             if(GuiButton({screenWidth - 120, 30, 100, 30}, "Initialize")){
-                wfc.initialize(64, 64, 0, tileset);
+                int size = gridSizes[gridSizeIndex];
+                int newCellSize = std::clamp(viewWidth / size, 1, 15);
+                if(newCellSize != cellSize){
+                    if(atlas.id) UnloadTexture(atlas);
+                    atlas = buildAtlas(tileset, newCellSize);
+                    cellSize = newCellSize;
+                }
+                if(canvas.id) UnloadRenderTexture(canvas);
+                canvas = LoadRenderTexture(size * cellSize, size * cellSize);
+                wfc.initialize(size, size, 0, compiled);
             }
 
-            if(GuiButton({screenWidth - 120, 70, 100, 30}, "Solve")){
-                wfc.solve(-1, 10);
+            lufuWFC::SolveProgress progress = wfc.getProgress();
+            if(progress.status == lufuWFC::SolveStatus::Running){
+                if(GuiButton({screenWidth - 120, 70, 100, 30}, "Cancel")){
+                    wfc.cancelSolve();
+                }
+            } else if(GuiButton({screenWidth - 120, 70, 100, 30}, "Solve")){
+                wfc.beginSolve(10);
             }
+            float fraction = progress.fraction();
+            GuiProgressBar({screenWidth - 120, 190, 100, 20}, nullptr, nullptr, &fraction, 0, 1);
 
             if(GuiButton({screenWidth - 120, 110, 100, 30}, "Step")){
                 wfc.solve(1, 10);
             }
             if(GuiButton({screenWidth - 120, 150, 100, 30}, "Backtrack")){
-                wfc.tracker.revert(wfc.grid);
+                wfc.revert();
+            }
+            // Takes effect on the next initialize
+            if(GuiButton({screenWidth - 120, 230, 100, 30}, TextFormat("Size %dx%d", gridSizes[gridSizeIndex], gridSizes[gridSizeIndex]))){
+                gridSizeIndex = (gridSizeIndex + 1) % std::size(gridSizes);
             }
 
+            DrawFPS(screenWidth - 120, screenHeight - 30);
+
         EndDrawing();
         //----------------------------------------------------------------------------------
     }
 
     // De-Initialization
     //--------------------------------------------------------------------------------------
+    if(atlas.id) UnloadTexture(atlas);
+    if(canvas.id) UnloadRenderTexture(canvas);
     CloseWindow(); // Close window and OpenGL context
     //--------------------------------------------------------------------------------------
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,743 @@
+// lufuwfc-tests: regression tests of solver bugs
+//
+// Every test sets up the situation of one bug and checks the fixed behavior. Returns 1 if any test failed.
+
+#include <lufuWFC.hpp>
+#include <lufuWFC/batch.hpp>
+#include <lufuWFC/overlap.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <map>
+#include <new>
+#include <string>
+#include <vector>
+
+#ifndef LUFUWFC_EXAMPLES_DIR
+#define LUFUWFC_EXAMPLES_DIR "examples"
+#endif
+
+using namespace lufuWFC;
+
+// Count every allocation of the process. The operators are kept out of line, otherwise GCC pairs
+// the inlined malloc and free with new and delete and warns about a mismatch
+#if defined(__GNUC__)
+#define TESTS_NOINLINE __attribute__((noinline))
+#else
+#define TESTS_NOINLINE
+#endif
+
+static std::atomic<size_t> gAllocations{0};
+
+TESTS_NOINLINE void* operator new(size_t size){
+    gAllocations.fetch_add(1, std::memory_order_relaxed);
+    if(void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+TESTS_NOINLINE void* operator new[](size_t size){ return operator new(size); }
+TESTS_NOINLINE void operator delete(void* p) noexcept { std::free(p); }
+TESTS_NOINLINE void operator delete[](void* p) noexcept { std::free(p); }
+TESTS_NOINLINE void operator delete(void* p, size_t) noexcept { std::free(p); }
+TESTS_NOINLINE void operator delete[](void* p, size_t) noexcept { std::free(p); }
+
+static std::shared_ptr<const CompiledTileSet> loadExample(const std::string& name){
+    TileSet tileset;
+    tileset.loadFromFile(std::string(LUFUWFC_EXAMPLES_DIR) + "/" + name);
+    return std::make_shared<const CompiledTileSet>(tileset);
+}
+
+static bool check(bool condition, const char* what){
+    if(!condition) std::fprintf(stderr, "  failed: %s\n", what);
+    return condition;
+}
+
+// Square tileset where every pair of tiles fits next to each other with the given chance, mirrored on opposite sides
+static std::shared_ptr<const CompiledTileSet> syntheticTiles(size_t count, double density, uint64_t seed){
+    Random random(seed);
+    std::vector<uint8_t> allowed(4 * count * count, 0);
+    for (size_t a=0; a < count; a++) {
+        for (size_t b=0; b < count; b++) {
+            for (size_t d=0; d < 2; d++) {
+                if(a == b or random.next() % 1000 < density * 1000){
+                    allowed[(d * count + a) * count + b] = 1;
+                    allowed[((d + 2) * count + b) * count + a] = 1;
+                }
+            }
+        }
+    }
+
+    std::vector<double> weights(count);
+    std::vector<uint32_t> offsets(1, 0), compatible;
+    for (size_t t=0; t < count; t++) weights[t] = 1 + static_cast<double>(random.next() % 10);
+    for (size_t d=0; d < 4; d++) {
+        for (size_t a=0; a < count; a++) {
+            for (size_t b=0; b < count; b++) {
+                if(allowed[(d * count + a) * count + b]) compatible.push_back(static_cast<uint32_t>(b));
+            }
+            offsets.push_back(static_cast<uint32_t>(compatible.size()));
+        }
+    }
+    auto tiles = std::make_shared<CompiledTileSet>();
+    tiles->compile(4, weights, offsets, compatible);
+    return tiles;
+}
+
+// A contradiction between manually set cells is below the floor, a restart can't undo it
+static bool restartAtFloor(){
+    auto tiles = loadExample("landtiles.json");
+    bool ok = true;
+    for (auto restart : {SearchStrategy::Restart::None, SearchStrategy::Restart::Luby, SearchStrategy::Restart::Geometric}) {
+        WFC wfc;
+        wfc.setSink(nullptr);
+        SearchStrategy strategy;
+        strategy.restart = restart;
+        wfc.setSearchStrategy(strategy);
+        wfc.initialize(4, 1, 0, tiles);
+        wfc.manualSetCell(0, 0, std::string("grass"));
+        wfc.manualSetCell(1, 0, std::string("water"));
+        ok &= check(!wfc.solve(-1, 10), "solve of conflicting fixed cells returns false");
+        ok &= check(wfc.failed(), "conflicting fixed cells stay failed");
+    }
+    return ok;
+}
+
+// Cells outside of the grid and unknown tile indices are rejected like unknown tile names
+static bool manualSetCellRange(){
+    auto tiles = loadExample("landtiles.json");
+    WFC wfc;
+    wfc.setSink(nullptr);
+    wfc.initialize(4, 3, 0, tiles);
+    wfc.manualSetCell(4, 0, size_t(0));
+    wfc.manualSetCell(0, 3, size_t(0));
+    wfc.manualSetCell(0, 0, tiles->tileCount);
+    wfc.manualSetCell(0, 0, std::string("no such tile"));
+    bool ok = check(!wfc.failed() and wfc.getDecisionLevel() == 0, "rejected cells leave the wave untouched");
+    ok &= check(wfc.solve(-1, 100), "grid solves after rejected cells");
+    return ok;
+}
+
+// A wave copied out of a presolve cache solves like a presolved one, also for a recompiled tileset
+static bool presolveCache(){
+    TileSet tileset;
+    tileset.loadFromFile(std::string(LUFUWFC_EXAMPLES_DIR) + "/pathtiles.json");
+    auto cache = std::make_shared<PresolveCache>();
+    bool ok = true;
+    for (auto propagator : {Propagator::SupportCount, Propagator::Bitset}) {
+        WFC cached, fresh;
+        cached.setSink(nullptr);
+        fresh.setSink(nullptr);
+        cached.setPropagator(propagator);
+        fresh.setPropagator(propagator);
+        cached.setPresolveCache(cache);
+        for (int seed=0; seed < 4; seed++) {
+            // Every initialize compiles the tileset again
+            cached.initialize(Topology::square(24, 16), seed, tileset);
+            fresh.initialize(Topology::square(24, 16), seed, tileset);
+            TileMap a, b;
+            bool solvedA = cached.solve(-1, 100), solvedB = fresh.solve(-1, 100);
+            cached.getTiles(a);
+            fresh.getTiles(b);
+            ok &= check(solvedA == solvedB and a.mTiles == b.mTiles, "cached initialize solves like a fresh one");
+        }
+    }
+    ok &= check(cache->bytes() > 0 and cache->bytes() < 24 * 16 * 64, "cache keeps one small wave per propagator");
+    return ok;
+}
+
+// A wrapped hex grid with an odd height has asymmetric neighbors, the solver has to refuse it
+static bool hexWrapOddHeight(){
+    // One tile that fits next to itself in all six directions
+    auto tiles = std::make_shared<CompiledTileSet>();
+    const double weights[] = {1};
+    const uint32_t offsets[] = {0, 1, 2, 3, 4, 5, 6};
+    const uint32_t compatible[] = {0, 0, 0, 0, 0, 0};
+    tiles->compile(6, weights, offsets, compatible);
+
+    bool ok = true;
+    WFC wfc;
+    wfc.setSink(nullptr);
+    wfc.initialize(Topology::hex(4, 3, true), 0, tiles);
+    ok &= check(wfc.failed() and !wfc.solve(-1, 10), "wrapped hex grid with odd height is refused");
+
+    Topology even = Topology::hex(4, 4, true);
+    std::vector<int32_t> table;
+    even.buildNeighbors(table);
+    for (size_t cell=0; cell < even.size(); cell++) {
+        for (size_t d=0; d < 6; d++) {
+            int32_t n = table[cell * 6 + d];
+            ok &= check(n >= 0 and table[static_cast<size_t>(n) * 6 + (d + 3) % 6] == static_cast<int32_t>(cell), "wrapped hex neighbors are symmetric");
+        }
+    }
+    wfc.initialize(even, 0, tiles);
+    ok &= check(wfc.solve(-1, 10), "wrapped hex grid with even height solves");
+    return ok;
+}
+
+// Regenerating a region forgets the removals of earlier solves, the trail doesn't grow with every call
+static bool regenerateTrail(){
+    auto tiles = loadExample("landtiles.json");
+    WFC wfc;
+    wfc.setSink(nullptr);
+    wfc.initialize(32, 32, 0, tiles);
+    bool ok = check(wfc.solve(-1, 100), "grid solves");
+    std::vector<uint8_t> snapshot;
+    size_t first = 0;
+    for (int n=0; n < 40; n++) {
+        ok &= check(wfc.regenerate(8, 8, 8, 8, 100), "region regenerates");
+        ok &= check(wfc.snapshot(snapshot), "snapshot succeeds");
+        if(n == 0) first = snapshot.size();
+        ok &= check(snapshot.size() <= first + first / 4, "snapshot doesn't grow with every regenerate");
+    }
+    return ok;
+}
+
+// Batch seeds that only differ above bit 31 used to be truncated to the same int seed
+static bool wideSeeds(){
+    BatchSettings settings;
+    settings.width = settings.height = 32;
+    settings.threads = 1;
+    BatchSolver batch(loadExample("landtiles.json"), settings);
+    std::vector<TileMap> maps;
+    for (uint64_t seed : {uint64_t(7), uint64_t(7) + (uint64_t(1) << 32), uint64_t(7) + (uint64_t(1) << 63)}) {
+        batch.run(seed, seed + 1, [&](const BatchResult& result){ maps.push_back(result.map); });
+    }
+    bool ok = check(maps.size() == 3, "every seed is solved");
+    for (size_t a=0; a < maps.size(); a++) {
+        for (size_t b=a + 1; b < maps.size(); b++) {
+            ok &= check(maps[a].mTiles != maps[b].mTiles, "seeds differing in the high bits give different maps");
+        }
+    }
+
+    // Every integer type picks the one 64 bit overload, the int entry point of a TileSet forwards to it
+    TileSet tileset;
+    tileset.loadFromFile(std::string(LUFUWFC_EXAMPLES_DIR) + "/landtiles.json");
+    auto compiled = std::make_shared<const CompiledTileSet>(tileset);
+    std::vector<std::vector<int32_t>> seeded;
+    auto solveWith = [&](auto seed, auto& tiles){
+        WFC wfc;
+        wfc.setSink(nullptr);
+        wfc.initialize(16, 16, seed, tiles);
+        wfc.solve(-1, 1000);
+        TileMap map;
+        wfc.getTiles(map);
+        seeded.push_back(map.mTiles);
+    };
+    solveWith(5, tileset);
+    solveWith(5, compiled);
+    solveWith(5u, compiled);
+    solveWith(5l, compiled);
+    solveWith(size_t(5), compiled);
+    for (const auto& tiles : seeded) {
+        ok &= check(tiles == seeded[0], "the same seed of any integer type gives the same map");
+    }
+    return ok;
+}
+
+// A corrupted snapshot has to be rejected or restore into a solver that still runs. Bans are on the trail
+// of the path tiles after a few contradictions, so the ban index is part of what gets corrupted
+static bool corruptSnapshot(){
+    auto tiles = loadExample("pathtiles.json");
+    WFC wfc;
+    wfc.setSink(nullptr);
+    SearchStrategy strategy;
+    strategy.restart = SearchStrategy::Restart::Luby;
+    wfc.setSearchStrategy(strategy);
+    wfc.initialize(24, 24, 3, tiles);
+
+    // A ban is a trail entry whose tile has bit 31 set, the last byte of its varint is 0x08. Step until there is one
+    const uint8_t banTail[] = {0x80, 0x80, 0x80, 0x08};
+    std::vector<uint8_t> original;
+    auto ban = original.end();
+    for (int step=0; step < 24 * 24 and ban == original.end(); step++) {
+        wfc.solve(1, 100);
+        wfc.snapshot(original);
+        ban = std::find_end(original.begin(), original.end(), std::begin(banTail), std::end(banTail));
+    }
+    bool ok = check(ban != original.end(), "snapshot has a ban on the trail");
+    WFC restored;
+    restored.setSink(nullptr);
+    ok &= check(restored.restore(original, tiles), "intact snapshot restores");
+    ok &= check(restored.getSearchStats().decisions == wfc.getSearchStats().decisions
+                and restored.getSearchStats().restarts == wfc.getSearchStats().restarts, "search stats survive the snapshot");
+
+    // Clearing the flag leaves a valid varint, but the ban index then points at a plain removal
+    if(ban != original.end()){
+        std::vector<uint8_t> data = original;
+        data[std::distance(original.begin(), ban) + 3] = 0;
+        ok &= check(!restored.restore(data, tiles), "ban index pointing at a plain removal is rejected");
+    }
+
+    Random random(1);
+    for (int n=0; n < 1000; n++) {
+        std::vector<uint8_t> data = original;
+        for (int flips=0; flips < 1 + n % 3; flips++) {
+            data[random.next() % data.size()] ^= static_cast<uint8_t>(1u << (random.next() % 8));
+        }
+        if(restored.restore(data, tiles)){
+            restored.solve(-1, 20);
+        }
+    }
+    return ok;
+}
+
+// Every cell gets its own tiles, so the rules between two tiles are the constraint between their cells. Tiles
+// only fit next to the tiles of the neighboring cells, which pins them to their cell once the wave is presolved.
+// weights[cell] are the weights of the values of a cell, allowed(a, valueA, b, valueB) the constraint
+static std::shared_ptr<const CompiledTileSet> cellTiles(size_t width, size_t height, const std::vector<std::vector<double>>& weights,
+                                                        const std::function<bool(size_t, size_t, size_t, size_t)>& allowed){
+    const int dx[] = {0, 1, 0, -1}, dy[] = {-1, 0, 1, 0};
+    std::vector<size_t> first(width * height + 1, 0);
+    for (size_t c=0; c < width * height; c++) first[c + 1] = first[c] + weights[c].size();
+
+    std::vector<double> tileWeights;
+    for (const auto& cell : weights) tileWeights.insert(tileWeights.end(), cell.begin(), cell.end());
+    std::vector<uint32_t> offsets(1, 0), compatible;
+    for (size_t d=0; d < 4; d++) {
+        for (size_t c=0; c < width * height; c++) {
+            int x = static_cast<int>(c % width) + dx[d], y = static_cast<int>(c / width) + dy[d];
+            bool inside = x >= 0 and y >= 0 and x < static_cast<int>(width) and y < static_cast<int>(height);
+            for (size_t a=0; a < weights[c].size(); a++) {
+                size_t n = inside ? static_cast<size_t>(x) + width * static_cast<size_t>(y) : 0;
+                for (size_t b=0; inside and b < weights[n].size(); b++) {
+                    if(allowed(c, a, n, b) and allowed(n, b, c, a)) compatible.push_back(static_cast<uint32_t>(first[n] + b));
+                }
+                offsets.push_back(static_cast<uint32_t>(compatible.size()));
+            }
+        }
+    }
+    auto tiles = std::make_shared<CompiledTileSet>();
+    tiles->compile(4, tileWeights, offsets, compatible);
+    return tiles;
+}
+
+// A decision that makes a 2x2 block unsolvable, then many unrelated decisions, then the block. Chronological
+// backtracking tries every combination of the unrelated cells before it reaches the bad decision, backjumping
+// sees that only the bad decision removed tiles around the block and jumps right back to it
+static bool backjumpingSavesWork(){
+    // Column 0: the bad decision x over a filler. Columns 1 and 2: the block, column 3: fillers that keep the
+    // free cells out of the neighborhood of the block, then two rows of free cells
+    const size_t freeColumns = 6, width = 4 + freeColumns, height = 2;
+    const size_t x = 0, p = 1, q = 2, r = width + 1, s = width + 2;
+    std::vector<std::vector<double>> weights(width * height);
+    for (size_t c=0; c < width * height; c++) {
+        size_t column = c % width;
+        // x picks the odd block nearly always. The free cells have less entropy than the block, so they come first
+        weights[c] = c == x ? std::vector<double>{1, 1e6} : column == 1 or column == 2 ? std::vector<double>(4, 1)
+                   : column >= 4 ? std::vector<double>{1, 3} : std::vector<double>{1};
+    }
+    // Block values are variant * 2 + bit. Neighbors in the block share the variant and the bit, except p and r,
+    // whose bits differ in the odd variant. The odd variant has no solution
+    auto allowed = [&](size_t a, size_t valueA, size_t b, size_t valueB){
+        if(a == x and b == p) return valueA == valueB / 2;
+        bool block = (a == p or a == q or a == r or a == s) and (b == p or b == q or b == r or b == s);
+        if(!block) return true;
+        bool flip = (a == p and b == r) or (a == r and b == p);
+        return valueA / 2 == valueB / 2 and ((valueA % 2 != valueB % 2) == (flip and valueA / 2 == 1));
+    };
+    auto tiles = cellTiles(width, height, weights, allowed);
+
+    size_t backtracks[2] = {};
+    bool ok = true;
+    for (bool backjumping : {false, true}) {
+        WFC wfc;
+        wfc.setSink(nullptr);
+        SearchStrategy strategy;
+        strategy.backjumping = backjumping;
+        wfc.setSearchStrategy(strategy);
+        wfc.initialize(Topology::square(width, height), 0, tiles);
+        ok &= check(wfc.solve(-1, 100000), "block solves with the even variant");
+        backtracks[backjumping] = wfc.getSearchStats().backtracks;
+    }
+    ok &= check(backtracks[1] <= 2, "backjumping goes straight back to the bad decision");
+    ok &= check(backtracks[0] >= (size_t(1) << (2 * freeColumns)), "chronological backtracking tries every free combination");
+    return ok;
+}
+
+// initialize reserves every buffer a solve needs, a solve must not allocate. Sparse tilesets with many tiles
+// grow the pending removals and the conflict levels the most
+static bool solveAllocations(){
+    std::vector<std::shared_ptr<const CompiledTileSet>> tilesets = {loadExample("landtiles.json"), loadExample("pathtiles.json"),
+                                                                    syntheticTiles(256, 0.02, 1), syntheticTiles(1024, 0.05, 2)};
+    bool ok = true;
+    for (const auto& tiles : tilesets) {
+        for (auto propagator : {Propagator::SupportCount, Propagator::Bitset}) {
+            for (size_t size : {4, 8, 32}) {
+                WFC wfc;
+                wfc.setSink(nullptr);
+                wfc.setPropagator(propagator);
+                for (int seed=0; seed < 3; seed++) {
+                    wfc.initialize(static_cast<int>(size), static_cast<int>(size), seed, tiles);
+                    size_t before = gAllocations.load();
+                    wfc.solve(-1, 1000);
+                    ok &= check(gAllocations.load() == before, "solve after initialize doesn't allocate");
+                }
+            }
+        }
+    }
+    return ok;
+}
+
+// Propagating in bands on several threads gives the same maps and search as one thread. The sparse synthetic
+// tileset runs the bands into contradictions, so the serial repeat of a propagation is covered too
+static bool parallelPropagation(){
+    std::vector<std::shared_ptr<const CompiledTileSet>> tilesets = {loadExample("landtiles.json"), loadExample("pathtiles.json"),
+                                                                    syntheticTiles(64, 0.3, 3), syntheticTiles(64, 0.1, 4)};
+    bool ok = true;
+    for (const auto& tiles : tilesets) {
+        for (uint64_t seed=0; seed < 4; seed++) {
+            WFC serial, parallel;
+            for (WFC* wfc : {&serial, &parallel}) {
+                wfc->setSink(nullptr);
+                wfc->setPropagator(Propagator::SupportCount);
+            }
+            parallel.setPropagationThreads(4, 16);
+            serial.initialize(48, 48, seed, tiles);
+            parallel.initialize(48, 48, seed, tiles);
+            bool serialSolved = serial.solve(-1, 200), parallelSolved = parallel.solve(-1, 200);
+
+            TileMap serialMap, parallelMap;
+            serial.getTiles(serialMap);
+            parallel.getTiles(parallelMap);
+            ok &= check(serialSolved == parallelSolved and serialMap.mTiles == parallelMap.mTiles, "parallel propagation gives the serial map");
+            ok &= check(serial.getSearchStats().decisions == parallel.getSearchStats().decisions
+                        and serial.getSearchStats().backtracks == parallel.getSearchStats().backtracks, "parallel propagation takes the serial decisions");
+        }
+    }
+    return ok;
+}
+
+// Every kernel level the CPU supports computes the same unions and counts as the scalar kernels, for word
+// counts around the vector widths, and the bitset propagator solves the same maps with each of them
+static bool simdKernels(){
+    bool ok = true;
+    const simd::Kernels scalar = simd::kernelsFor(simd::Level::Scalar);
+    const simd::Level best = simd::kernels().level;
+    Random random(9);
+    for (simd::Level level : {simd::Level::AVX2, simd::Level::AVX512}) {
+        if(!simd::supported(level)){
+            continue;
+        }
+        const simd::Kernels kernels = simd::kernelsFor(level);
+        for (size_t words=1; words <= 19; words++) {
+            std::vector<uint64_t> domain(words), valid(words), masks(words * 64 * words), expected(words), actual(words);
+            for (uint64_t& word : masks) word = random.next() & random.next();
+            for (int round=0; round < 20; round++) {
+                for (size_t w=0; w < words; w++) {
+                    domain[w] = round % 4 == 0 ? 0 : random.next() & random.next() & random.next();
+                    valid[w] = round % 5 == 0 ? domain[w] | random.next() : random.next();
+                }
+                scalar.unionOfMasks(expected.data(), domain.data(), masks.data(), words);
+                kernels.unionOfMasks(actual.data(), domain.data(), masks.data(), words);
+                ok &= check(actual == expected, "simd union of masks equals the scalar one");
+                ok &= check(kernels.countRemoved(domain.data(), valid.data(), words) == scalar.countRemoved(domain.data(), valid.data(), words),
+                            "simd count of removed tiles equals the scalar one");
+            }
+        }
+    }
+
+    // Whole solves, the tileset with 64 tiles fills one word and the one with 300 tiles five
+    for (const auto& tiles : {loadExample("pathtiles.json"), syntheticTiles(64, 0.3, 7), syntheticTiles(300, 0.1, 8)}) {
+        std::vector<int32_t> reference;
+        for (simd::Level level : {simd::Level::Scalar, simd::Level::AVX2, simd::Level::AVX512}) {
+            if(!simd::select(level)){
+                continue;
+            }
+            WFC wfc;
+            wfc.setSink(nullptr);
+            wfc.setPropagator(Propagator::Bitset);
+            wfc.initialize(32, 32, 5, tiles);
+            wfc.solve(-1, 200);
+            TileMap map;
+            wfc.getTiles(map);
+            if(level == simd::Level::Scalar){
+                reference = map.mTiles;
+            }
+            ok &= check(map.mTiles == reference, "every kernel level solves the scalar map");
+        }
+    }
+    simd::select(best);
+    return ok;
+}
+
+// The fixed size solvers give the same maps and search as the runtime sized one for 1 to 4 words per cell,
+// and a fixed size solver refuses a tileset with another number of words
+static bool fixedWordSolvers(){
+    std::vector<std::shared_ptr<const CompiledTileSet>> tilesets = {loadExample("landtiles.json"), syntheticTiles(100, 0.2, 10),
+                                                                    syntheticTiles(150, 0.2, 11), syntheticTiles(256, 0.1, 12)};
+    bool ok = true;
+    for (const auto& tiles : tilesets) {
+        for (auto propagator : {Propagator::SupportCount, Propagator::Bitset}) {
+            for (uint64_t seed=0; seed < 3; seed++) {
+                WFC runtime;
+                runtime.setSink(nullptr);
+                runtime.setPropagator(propagator);
+                runtime.initialize(24, 24, seed, tiles);
+                bool runtimeSolved = runtime.solve(-1, 200);
+                TileMap runtimeMap;
+                runtime.getTiles(runtimeMap);
+
+                withSolverWords(*tiles, [&](auto words){
+                    BasicWFC<decltype(words)::value> fixed;
+                    fixed.setSink(nullptr);
+                    fixed.setPropagator(propagator);
+                    fixed.initialize(24, 24, seed, tiles);
+                    bool fixedSolved = fixed.solve(-1, 200);
+                    TileMap fixedMap;
+                    fixed.getTiles(fixedMap);
+                    ok &= check(decltype(words)::value == tiles->words, "every tileset here gets a fixed size solver");
+                    ok &= check(fixedSolved == runtimeSolved and fixedMap.mTiles == runtimeMap.mTiles, "fixed size solver gives the runtime sized map");
+                    ok &= check(fixed.getSearchStats().backtracks == runtime.getSearchStats().backtracks, "fixed size solver takes the same search");
+                });
+            }
+        }
+    }
+
+    BasicWFC<2> wrongSize;
+    wrongSize.setSink(nullptr);
+    wrongSize.initialize(8, 8, 0, loadExample("landtiles.json"));
+    ok &= check(wrongSize.failed(), "fixed size solver refuses a tileset with another number of words");
+    return ok;
+}
+
+// A solve spread over many small solveFor slices ends in the same map as one solve call, also through
+// contradictions, backjumps and restarts that are cut in the middle of a propagation
+static bool slicedSolve(){
+    bool ok = true;
+    for (const char* name : {"landtiles.json", "pathtiles.json"}) {
+        auto tiles = loadExample(name);
+        for (auto propagator : {Propagator::SupportCount, Propagator::Bitset}) {
+            for (uint64_t seed=0; seed < 3; seed++) {
+                SearchStrategy strategy;
+                if(seed == 1){
+                    strategy.backjumping = true;
+                } else if(seed == 2){
+                    strategy.restart = SearchStrategy::Restart::Luby;
+                    strategy.restartBase = 4;
+                }
+                WFC whole, sliced;
+                for (WFC* wfc : {&whole, &sliced}) {
+                    wfc->setSink(nullptr);
+                    wfc->setPropagator(propagator);
+                    wfc->setSearchStrategy(strategy);
+                    wfc->initialize(40, 40, seed, tiles);
+                }
+                bool solved = whole.solve(-1, 300);
+
+                sliced.beginSolve(300);
+                size_t slices = 0;
+                SolveStatus status;
+                while ((status = sliced.solveFor({std::numeric_limits<double>::infinity(), 7})) == SolveStatus::Running) {
+                    slices++;
+                }
+
+                TileMap wholeMap, slicedMap;
+                whole.getTiles(wholeMap);
+                sliced.getTiles(slicedMap);
+                ok &= check(slices > 100, "a work budget of 7 splits the solve into many slices");
+                ok &= check((status == SolveStatus::Solved) == solved and slicedMap.mTiles == wholeMap.mTiles, "sliced solve ends in the map of one solve");
+                ok &= check(sliced.getSearchStats().backtracks == whole.getSearchStats().backtracks, "sliced solve takes the same search");
+            }
+        }
+    }
+    return ok;
+}
+
+// A snapshot taken between two solveFor slices, often in the middle of a propagation, restores into a fresh
+// solver that ends in the same map as the uninterrupted solve. Restoring and taking the snapshot again gives the
+// same bytes
+static bool snapshotMidSolve(){
+    bool ok = true;
+    for (const char* name : {"landtiles.json", "pathtiles.json"}) {
+        auto tiles = loadExample(name);
+        for (auto propagator : {Propagator::SupportCount, Propagator::Bitset}) {
+            SearchStrategy strategy;
+            strategy.restart = SearchStrategy::Restart::Luby;
+            strategy.restartBase = 4;
+            strategy.backjumping = true;
+
+            WFC whole;
+            whole.setSink(nullptr);
+            whole.setPropagator(propagator);
+            whole.setSearchStrategy(strategy);
+            whole.initialize(32, 32, 2, tiles);
+            bool solved = whole.solve(-1, 300);
+            TileMap wholeMap;
+            whole.getTiles(wholeMap);
+
+            WFC sliced;
+            sliced.setSink(nullptr);
+            sliced.setPropagator(propagator);
+            sliced.setSearchStrategy(strategy);
+            sliced.initialize(32, 32, 2, tiles);
+            sliced.beginSolve(300);
+            std::vector<uint8_t> data, again;
+            size_t restores = 0;
+            for (size_t slice=0; sliced.solveFor({std::numeric_limits<double>::infinity(), 5}) == SolveStatus::Running; slice++) {
+                if(slice % 37 != 0){
+                    continue;
+                }
+                ok &= check(sliced.snapshot(data), "running solver takes a snapshot");
+                WFC restored;
+                restored.setSink(nullptr);
+                if(!check(restored.restore(data, tiles), "snapshot restores")){
+                    return false;
+                }
+                restored.snapshot(again);
+                ok &= check(again == data, "restored solver takes the same snapshot");
+
+                SolveStatus status;
+                while ((status = restored.solveFor({std::numeric_limits<double>::infinity(), 5})) == SolveStatus::Running) {}
+                TileMap restoredMap;
+                restored.getTiles(restoredMap);
+                ok &= check((status == SolveStatus::Solved) == solved and restoredMap.mTiles == wholeMap.mTiles, "restored solver ends in the uninterrupted map");
+                restores++;
+            }
+            ok &= check(restores > 5, "the solve is snapshotted several times");
+        }
+    }
+    return ok;
+}
+
+// Patterns of a sample found by brute force: every n x n window of the sample and of its rotations and
+// reflections, in colors, with how often it appears
+static std::map<std::vector<uint32_t>, double> bruteForcePatterns(const std::vector<uint32_t>& pixels, size_t width, size_t height,
+                                                                  const OverlapSettings& settings){
+    std::map<std::vector<uint32_t>, double> patterns;
+    size_t n = settings.n;
+    for (size_t s=0; s < settings.symmetry; s++) {
+        // s / 2 counterclockwise quarter turns, mirrored left to right for odd s
+        std::vector<uint32_t> image = pixels;
+        size_t w = width, h = height;
+        for (size_t turn=0; turn < s / 2; turn++) {
+            std::vector<uint32_t> turned(image.size());
+            for (size_t y=0; y < w; y++) {
+                for (size_t x=0; x < h; x++) turned[y * h + x] = image[x * w + w - 1 - y];
+            }
+            image = std::move(turned);
+            std::swap(w, h);
+        }
+        if(s % 2){
+            for (size_t y=0; y < h; y++) std::reverse(image.begin() + y * w, image.begin() + (y + 1) * w);
+        }
+
+        size_t countX = settings.periodic ? w : w - n + 1, countY = settings.periodic ? h : h - n + 1;
+        for (size_t y=0; y < countY; y++) {
+            for (size_t x=0; x < countX; x++) {
+                std::vector<uint32_t> window;
+                for (size_t dy=0; dy < n; dy++) {
+                    for (size_t dx=0; dx < n; dx++) window.push_back(image[((y + dy) % h) * w + (x + dx) % w]);
+                }
+                patterns[window]++;
+            }
+        }
+    }
+    return patterns;
+}
+
+// The patterns, weights and overlaps of OverlapModel match a brute force extraction. Three colored stripes give
+// exactly the shifted stripes, and the solved map repeats the stripes
+static bool overlapExtraction(){
+    bool ok = true;
+    const uint32_t a = 0xff0000ff, b = 0xff00ff00, c = 0xffff0000;
+    std::vector<uint32_t> stripes = {a, b, c, a, b, c, a, b, c};
+
+    OverlapModel stripeModel;
+    ok &= check(stripeModel.extract(stripes, 3, 3, {2, 1, true}), "stripes are extracted");
+    ok &= check(stripeModel.patternCount() == 3, "three stripe colors give three patterns");
+    OverlapModel symmetric;
+    symmetric.extract(stripes, 3, 3, {2, 8, true});
+    ok &= check(symmetric.patternCount() == 12, "reflected and rotated stripes give twelve patterns");
+
+    WFC wfc;
+    wfc.setSink(nullptr);
+    wfc.initialize(9, 6, 0, stripeModel.tileset());
+    ok &= check(wfc.solve(-1, 100), "stripes solve");
+    TileMap map;
+    wfc.getTiles(map);
+    std::vector<uint32_t> image;
+    stripeModel.render(map, image);
+    for (size_t y=0; y < map.mY; y++) {
+        for (size_t x=0; x < map.mX; x++) {
+            uint32_t expected = x >= 1 ? (image[y * map.mX + x - 1] == a ? b : image[y * map.mX + x - 1] == b ? c : a) : image[x];
+            ok &= check(image[y * map.mX + x] == (y > 0 ? image[x] : expected), "solved map repeats the stripes");
+        }
+    }
+
+    // Random samples against brute force, with and without wrapping
+    Random random(22);
+    const uint32_t colors[] = {a, b, c};
+    for (int round=0; round < 6; round++) {
+        size_t width = 5 + round, height = 4 + round % 3;
+        std::vector<uint32_t> pixels(width * height);
+        for (uint32_t& pixel : pixels) pixel = colors[random.next() % 3];
+        OverlapSettings settings{size_t(2 + round % 2), size_t(round < 3 ? 8 : 1 + round), round % 2 == 0};
+
+        OverlapModel model;
+        ok &= check(model.extract(pixels, width, height, settings), "random sample is extracted");
+        auto expected = bruteForcePatterns(pixels, width, height, settings);
+        ok &= check(model.patternCount() == expected.size(), "pattern count matches brute force");
+
+        auto tiles = model.tileset();
+        size_t n = model.size();
+        std::vector<std::vector<uint32_t>> found(model.patternCount());
+        for (size_t p=0; p < model.patternCount(); p++) {
+            for (uint32_t index : model.pattern(p)) found[p].push_back(model.palette()[index]);
+            auto it = expected.find(found[p]);
+            ok &= check(it != expected.end() and it->second == tiles->weights[p], "pattern and weight match brute force");
+        }
+
+        // b is north of a if b shifted down by one row covers a, and so on
+        const int dx[] = {0, 1, 0, -1}, dy[] = {-1, 0, 1, 0};
+        for (size_t p=0; p < found.size(); p++) {
+            for (size_t q=0; q < found.size(); q++) {
+                for (size_t d=0; d < 4; d++) {
+                    bool overlaps = true;
+                    for (int y=0; y < int(n); y++) {
+                        for (int x=0; x < int(n); x++) {
+                            int qx = x - dx[d], qy = y - dy[d];
+                            if(qx >= 0 and qy >= 0 and qx < int(n) and qy < int(n)){
+                                overlaps &= found[p][y * n + x] == found[q][qy * n + qx];
+                            }
+                        }
+                    }
+                    bool allowed = (tiles->adjacencyMask(p, d)[q / 64] >> (q % 64)) & 1;
+                    ok &= check(allowed == overlaps, "overlapping patterns are neighbors");
+                }
+            }
+        }
+    }
+    return ok;
+}
+
+int main(){
+    setLogStream(nullptr);
+    struct Test{ const char* name; std::function<bool()> run; };
+    const Test tests[] = {
+        {"restartAtFloor", restartAtFloor},
+        {"manualSetCellRange", manualSetCellRange},
+        {"presolveCache", presolveCache},
+        {"hexWrapOddHeight", hexWrapOddHeight},
+        {"regenerateTrail", regenerateTrail},
+        {"wideSeeds", wideSeeds},
+        {"corruptSnapshot", corruptSnapshot},
+        {"solveAllocations", solveAllocations},
+        {"backjumpingSavesWork", backjumpingSavesWork},
+        {"parallelPropagation", parallelPropagation},
+        {"simdKernels", simdKernels},
+        {"fixedWordSolvers", fixedWordSolvers},
+        {"slicedSolve", slicedSolve},
+        {"snapshotMidSolve", snapshotMidSolve},
+        {"overlapExtraction", overlapExtraction},
+    };
+
+    int failed = 0;
+    for (const Test& test : tests) {
+        bool passed = test.run();
+        std::fprintf(stderr, "%s %s\n", passed ? "PASS" : "FAIL", test.name);
+        failed += !passed;
+    }
+    return failed ? 1 : 0;
+}